@@ -125,6 +125,7 @@ static	int	 c_substitute		(void);
 static	void	 c_delfini		(void);
 static	int	 c_hmatch		(Char *);
 static	void	 c_hsetpat		(void);
+static	int	 c_hcheck		(struct Hist *);
 #ifdef COMMENT
 static	void	 c_get_word		(Char **, Char **);
 #endif
@@ -1843,13 +1844,41 @@ c_hsetpat(void)
 #endif
 }
 
+/*
+ * c_hcheck(): Does history event hp match the search pattern, and differ
+ * from the input line?
+ */
+static int
+c_hcheck(struct Hist *hp)
+{
+    Char *hl;
+    int matched;
+
+    if (hp->histline == NULL)
+	hp->histline = sprlex(&hp->Hlex);
+    if (HistLit)
+	hl = hp->histline;
+    else {
+	hl = sprlex(&hp->Hlex);
+	cleanup_push(hl, xfree);
+    }
+#ifdef SDEBUG
+    xprintf("Comparing with \"%S\"\n", hl);
+#endif
+    matched = (Strncmp(hl, InputBuf, (size_t) (LastChar - InputBuf)) ||
+	       hl[LastChar-InputBuf]) && c_hmatch(hl);
+    if (!HistLit)
+	cleanup_until(hl);
+    return matched;
+}
+
 /*ARGSUSED*/
 CCRETVAL
 e_up_search_hist(Char c)
 {
-    struct Hist *hp;
+    struct Hist *hp, *cur;
     int h;
-    int    found = 0;
+    int    found = 0, indexed;
 
     USE(c);
     ActionFlag = TCSHOP_NOP;
@@ -1876,34 +1905,25 @@ e_up_search_hist(Char c)
 
     c_hsetpat();		/* Set search pattern !! */
 
+    cur = NULL;
     for (h = 1; h <= Hist_num; h++)
-	hp = hp->Hnext;
+	cur = hp, hp = hp->Hnext;
 
-    while (hp != NULL) {
-	Char *hl;
-	int matched;
+    /* Look only at the events with the trigrams of the pattern, if any */
+    if ((indexed = histgramset(patbuf.s, 1)) != 0)
+	hp = histgramnext(cur);
 
-	if (hp->histline == NULL)
-	    hp->histline = sprlex(&hp->Hlex);
-	if (HistLit)
-	    hl = hp->histline;
-	else {
-	    hl = sprlex(&hp->Hlex);
-	    cleanup_push(hl, xfree);
-	}
-#ifdef SDEBUG
-	xprintf("Comparing with \"%S\"\n", hl);
-#endif
-	matched = (Strncmp(hl, InputBuf, (size_t) (LastChar - InputBuf)) ||
-		   hl[LastChar-InputBuf]) && c_hmatch(hl);
-	if (!HistLit)
-	    cleanup_until(hl);
-	if (matched) {
+    while (hp != NULL) {
+	if (c_hcheck(hp)) {
 	    found++;
 	    break;
 	}
-	h++;
-	hp = hp->Hnext;
+	if (indexed)
+	    hp = histgramnext(hp);
+	else {
+	    h++;
+	    hp = hp->Hnext;
+	}
     }
 
     if (!found) {
@@ -1913,6 +1933,11 @@ e_up_search_hist(Char c)
 	return(CC_ERROR);
     }
 
+    if (indexed)		/* count down to it */
+	for (cur = cur ? cur->Hnext : Histlist.Hnext; cur != hp;
+	     cur = cur->Hnext)
+	    h++;
+
     Hist_num = h;
 
     return(GetHistLine());
@@ -1922,7 +1947,7 @@ e_up_search_hist(Char c)
 CCRETVAL
 e_down_search_hist(Char c)
 {
-    struct Hist *hp;
+    struct Hist *hp, *cur;
     int h;
     int    found = 0;
 
@@ -1940,25 +1965,23 @@ e_down_search_hist(Char c)
 
     c_hsetpat();		/* Set search pattern !! */
 
-    for (h = 1; h < Hist_num && hp; h++) {
-	Char *hl;
-	if (hp->histline == NULL)
-	    hp->histline = sprlex(&hp->Hlex);
-	if (HistLit)
-	    hl = hp->histline;
-	else {
-	    hl = sprlex(&hp->Hlex);
-	    cleanup_push(hl, xfree);
+    if (histgramset(patbuf.s, 1)) {
+	/* Back up the events with the trigrams of the pattern */
+	for (h = 1, cur = hp; h < Hist_num && cur; h++)
+	    cur = cur->Hnext;
+	for (hp = histgramprev(cur); hp; hp = histgramprev(hp))
+	    if (c_hcheck(hp))
+		break;
+	if (hp != NULL)		/* count down to it */
+	    for (found = 1, cur = Histlist.Hnext; cur != hp; cur = cur->Hnext)
+		found++;
+    }
+    else {
+	for (h = 1; h < Hist_num && hp; h++) {
+	    if (c_hcheck(hp))
+		found = h;
+	    hp = hp->Hnext;
 	}
-#ifdef SDEBUG
-	xprintf("Comparing with \"%S\"\n", hl);
-#endif
-	if ((Strncmp(hl, InputBuf, (size_t) (LastChar - InputBuf)) || 
-	     hl[LastChar-InputBuf]) && c_hmatch(hl))
-	    found = h;
-	if (!HistLit)
-	    cleanup_until(hl);
-	hp = hp->Hnext;
     }
 
     if (!found) {		/* is it the current history number? */
@@ -83,20 +83,131 @@ static char sccsid[] = "@(#)glob.c	5.12 (Berkeley) 6/24/91";
 #define lstat stat
 #endif
 
+#if defined(DT_UNKNOWN) && defined(DTTOIF)
+# define dirmode(dp)	((dp)->d_type == DT_UNKNOWN ? 0 : DTTOIF((dp)->d_type))
+#else
+# define dirmode(dp)	0
+#endif
+
+#if defined(HAVE_FDOPENDIR) && defined(O_DIRECTORY) && defined(AT_SYMLINK_NOFOLLOW)
+# define GLOBAT		/* Look names up relative to their directory */
+#endif
+
+/* The workers call opendir() and malloc(), so they need a thread safe one */
+#if defined(HAVE_PTHREAD_H) && defined(SYSMALLOC)
+# define GLOBTHREADS	/* Read ** trees with gl_nthreads threads */
+# include <pthread.h>
+#endif /* HAVE_PTHREAD_H && SYSMALLOC */
+
 typedef unsigned short Char;
 
+/*
+ * A directory read ahead for a ** walk, with its entries sorted by name
+ */
+struct globdir {
+    char   *gd_path;		/* Ends in a slash, "" for . */
+    char   *gd_names;		/* The names, each ending in a NUL */
+    struct globdirent *gd_ents;
+    size_t  gd_nents;
+    int     gd_done;		/* Whether the whole directory was read */
+};
+
+struct globdirent {
+    size_t  gde_off;		/* Of the name in gd_names */
+    const char *gde_name;
+    mode_t  gde_mode;		/* 0 if unknown */
+    struct globdir *gde_dir;	/* Its own entries, if they were read */
+};
+
+/* What was read of an entry's directory, if it was all read */
+#define globdirof(ent)	((ent)->gde_dir != NULL && (ent)->gde_dir->gd_done ? \
+			 (ent)->gde_dir : NULL)
+
+/*
+ * What glob3() learned from readdir() about the path it hands to glob2():
+ * the directory it was read from and where the path leaves it, and its
+ * file type if known, so that it need not be stat()ed or looked up from
+ * the start again
+ */
+struct globent {
+    int     ge_fd;		/* Directory the name is in, -1 if none */
+    size_t  ge_len;		/* Length of its path in pathbuf */
+    mode_t  ge_mode;		/* File type of pathbuf, 0 if unknown */
+    const struct globdir *ge_dir; /* Its entries, if read ahead */
+};
+
+#ifdef GLOBTHREADS
+/*
+ * With gl_nthreads set, the tree under a ** is first read by that many
+ * workers, each taking directories from its own queue and stealing from
+ * the far end of another's when that runs dry.  They only fill in struct
+ * globdirs, using nothing but the system malloc(); glob2() and glob3()
+ * then search those just as they would the directories, so the matches
+ * do not change.
+ */
+# define GLOB_THREADSMAX 64
+
+struct globwalk {
+    struct globworker *gk_workers;
+    int     gk_nworkers;
+    int     gk_dot;		/* Whether to read dot directories */
+    pthread_mutex_t gk_lock;	/* For the rest */
+    pthread_cond_t gk_cond;
+    size_t  gk_pending;		/* Directories queued or being read */
+    unsigned long gk_queued;	/* Times directories were queued */
+};
+
+struct globworker {
+    struct globwalk *gw_walk;
+    pthread_mutex_t gw_lock;
+    struct globdir **gw_dirs;	/* Its own from the end, stolen ones */
+    size_t  gw_first, gw_last;	/* from the start */
+    size_t  gw_size;
+};
+#endif /* GLOBTHREADS */
+
+/*
+ * A pattern segment decoded once for all the names glob3() tests: a
+ * character, M_ALL, M_ONE, or M_SET followed by its go_c2 characters and
+ * M_RNG ranges, up to M_END
+ */
+struct globop {
+    Char    go_op;
+    __Char  go_c;		/* The character, the first of a range, or */
+    __Char  go_c2;		/* whether a set is negated; the last */
+};
+
 static	int	 glob1 		(Char *, glob_t *, int);
-static	int	 glob2		(struct strbuf *, const Char *, glob_t *, int);
+static	int	 glob2		(struct strbuf *, const Char *, glob_t *, int,
+				 const struct globent *);
 static	int	 glob3		(struct strbuf *, const Char *, const Char *,
-				 const Char *, glob_t *, int);
+				 const Char *, glob_t *, int,
+				 const struct globent *);
+static	const char *globnext	(DIR *, const struct globdir *, size_t *,
+				 struct globent *);
+static	const struct globdirent *globlookup (const struct globdir *,
+				 const char *);
+static	int	 globnamecmp	(const void *, const void *);
+#ifdef GLOBTHREADS
+static	int	 globentcmp	(const void *, const void *);
+static	void	 globdirfree	(struct globdir *);
+static	struct globdir *globwalk (const char *, const glob_t *);
+static	void	*globworker	(void *);
+static	struct globdir *globtake (struct globworker *, int);
+static	void	 globreaddir	(struct globworker *, struct globdir *);
+static	int	 globqueue	(struct globworker *, struct globdir *);
+#endif /* GLOBTHREADS */
 static	void	 globextend	(const char *, glob_t *);
-static	int	 match		(const char *, const Char *, const Char *,
-				 int);
+static	struct globop *globcomp (const Char *, const Char *, int);
+static	int	 match		(const char *, const struct globop *);
 static	int	 compare	(const void *, const void *);
 static 	DIR	*Opendir	(const char *);
+static 	DIR	*Opendirat	(const struct globent *, const char *);
 #ifdef S_IFLNK
 static	int	 Lstat		(const char *, struct stat *);
 #endif
+static	int	 Lstatat	(const struct globent *, const char *,
+				 struct stat *);
 static	int	 Stat		(const char *, struct stat *sb);
 static 	Char 	*Strchr		(Char *, int);
 #ifdef DEBUG
@@ -212,6 +323,34 @@ Opendir(const char *str)
     return opendir(str);
 }
 
+/*
+ * Open the directory str, relative to the directory it was found in if
+ * that is still open
+ */
+static DIR *
+Opendirat(const struct globent *ge, const char *str)
+{
+#ifdef GLOBAT
+    DIR    *dirp;
+    int     fd;
+
+    if (ge->ge_fd == -1)
+	return Opendir(str);
+    if ((fd = openat(ge->ge_fd, str + ge->ge_len, O_RDONLY | O_DIRECTORY)) == -1)
+	return NULL;
+    if ((dirp = fdopendir(fd)) == NULL) {
+	int e = errno;
+
+	(void) close(fd);
+	errno = e;
+    }
+    return dirp;
+#else
+    USE(ge);
+    return Opendir(str);
+#endif
+}
+
 #ifdef S_IFLNK
 static int
 Lstat(const char *fn, struct stat *sb)
@@ -242,6 +381,27 @@ Stat(const char *fn, struct stat *sb)
     return st;
 }
 
+/* Lstat(fn), relative to the directory it was found in if possible */
+static int
+Lstatat(const struct globent *ge, const char *fn, struct stat *sb)
+{
+#ifdef GLOBAT
+    int st;
+
+    if (ge->ge_fd == -1)
+	return Lstat(fn, sb);
+    st = fstatat(ge->ge_fd, fn + ge->ge_len, sb, AT_SYMLINK_NOFOLLOW);
+# ifdef NAMEI_BUG
+    if (*fn != 0 && strend(fn)[-1] == '/' && !S_ISDIR(sb->st_mode))
+	st = -1;
+# endif	/* NAMEI_BUG */
+    return st;
+#else
+    USE(ge);
+    return Lstat(fn, sb);
+#endif
+}
+
 static Char *
 Strchr(Char *str, int ch)
 {
@@ -463,6 +623,7 @@ static int
 glob1(Char *pattern, glob_t *pglob, int no_match)
 {
     struct strbuf pathbuf = strbuf_INIT;
+    struct globent ge;
     int err;
 
     /*
@@ -470,7 +631,11 @@ glob1(Char *pattern, glob_t *pglob, int no_match)
      */
     if (*pattern == EOS)
 	return (0);
-    err = glob2(&pathbuf, pattern, pglob, no_match);
+    ge.ge_fd = -1;
+    ge.ge_len = 0;
+    ge.ge_mode = 0;
+    ge.ge_dir = NULL;
+    err = glob2(&pathbuf, pattern, pglob, no_match, &ge);
     xfree(pathbuf.s);
     return err;
 }
@@ -481,13 +646,17 @@ glob1(Char *pattern, glob_t *pglob, int no_match)
  * more meta characters.
  */
 static int
-glob2(struct strbuf *pathbuf, const Char *pattern, glob_t *pglob, int no_match)
+glob2(struct strbuf *pathbuf, const Char *pattern, glob_t *pglob, int no_match,
+      const struct globent *pge)
 {
     struct stat sbuf;
+    struct globent ge;
+    const struct globdirent *ent;
     int anymeta;
     const Char *p;
     size_t orig_len;
 
+    ge = *pge;
     /*
      * loop over pattern segments until end of pattern or until segment with
      * meta character found.
@@ -497,7 +666,10 @@ glob2(struct strbuf *pathbuf, const Char *pattern, glob_t *pglob, int no_match)
 	if (*pattern == EOS) {	/* end of pattern? */
 	    strbuf_terminate(pathbuf);
 
-	    if (Lstat(pathbuf->s, &sbuf))
+	    /* readdir() already said it is there */
+	    if (ge.ge_mode != 0)
+		sbuf.st_mode = ge.ge_mode;
+	    else if (Lstatat(&ge, pathbuf->s, &sbuf))
 		return (0);
 
 	    if (((pglob->gl_flags & GLOB_MARK) &&
@@ -527,13 +699,29 @@ glob2(struct strbuf *pathbuf, const Char *pattern, glob_t *pglob, int no_match)
 	}
 
 	if (!anymeta) {		/* no expansion, do next segment */
+	    if (p != pattern) {
+		strbuf_terminate(pathbuf);
+		if (ge.ge_dir != NULL && (ent = globlookup(ge.ge_dir,
+		    pathbuf->s + orig_len)) != NULL) {
+		    ge.ge_mode = ent->gde_mode;
+		    ge.ge_dir = globdirof(ent);
+		} else {
+		    ge.ge_mode = 0;
+		    ge.ge_dir = NULL;
+		}
+	    }
+	    /* Only a directory is still known with a slash after it */
+	    if (*p == SEP && !S_ISDIR(ge.ge_mode)) {
+		ge.ge_mode = 0;
+		ge.ge_dir = NULL;
+	    }
 	    pattern = p;
 	    while (*pattern == SEP)
 		strbuf_append1(pathbuf, *pattern++);
 	}
 	else {			/* need expansion, recurse */
 	    pathbuf->len = orig_len;
-	    return (glob3(pathbuf, pattern, p, pattern, pglob, no_match));
+	    return (glob3(pathbuf, pattern, p, pattern, pglob, no_match, &ge));
 	}
     }
     /* NOTREACHED */
@@ -559,17 +747,21 @@ One_Char_mbtowc(__Char *pwc, const Char *s, size_t n)
  
 static int
 glob3(struct strbuf *pathbuf, const Char *pattern, const Char *restpattern,
-      const Char *pglobstar, glob_t *pglob, int no_match)
+      const Char *pglobstar, glob_t *pglob, int no_match,
+      const struct globent *pge)
 {
     DIR    *dirp;
-    struct dirent *dp;
     struct stat sbuf;
+    struct globent ge;
+    const char *name;
+    size_t  n;
     int     err;
     Char m_not = (pglob->gl_flags & GLOB_ALTNOT) ? M_ALTNOT : M_NOT;
     size_t orig_len;
     int globstar = 0;
     int chase_symlinks = 0;
     const Char *termstar = NULL;
+    struct globop *ops;
 
     strbuf_terminate(pathbuf);
     orig_len = pathbuf->len;
@@ -588,26 +780,44 @@ glob3(struct strbuf *pathbuf, const Char *pattern, const Char *restpattern,
         pglobstar += width;
     } 
 
+#ifdef GLOBTHREADS
+    /* Have the workers read the tree first, then search what they read */
+    if (globstar && pglobstar == pattern && pge->ge_dir == NULL &&
+	pglob->gl_nthreads > 1 && (ge.ge_dir = globwalk(pathbuf->s, pglob))) {
+	ge.ge_fd = pge->ge_fd;
+	ge.ge_len = pge->ge_len;
+	ge.ge_mode = *pathbuf->s ? S_IFDIR : 0;	/* "" names no file */
+	err = glob3(pathbuf, pattern, restpattern, pattern, pglob, no_match,
+		    &ge);
+	globdirfree((struct globdir *) ge.ge_dir);
+	return err;
+    }
+#endif /* GLOBTHREADS */
+
     if (globstar) {
 	err = pglobstar==pattern && termstar==restpattern ?
 		*restpattern == EOS ?
-		glob2(pathbuf, restpattern - 1, pglob, no_match) :
-		glob2(pathbuf, restpattern + 1, pglob, no_match) :
-		glob3(pathbuf, pattern, restpattern, termstar, pglob, no_match);
+		glob2(pathbuf, restpattern - 1, pglob, no_match, pge) :
+		glob2(pathbuf, restpattern + 1, pglob, no_match, pge) :
+		glob3(pathbuf, pattern, restpattern, termstar, pglob, no_match,
+		      pge);
 	if (err)
 	    return err;
 	pathbuf->len = orig_len;
 	strbuf_terminate(pathbuf);
     }
 
-    if (*pathbuf->s && (Lstat(pathbuf->s, &sbuf) || !S_ISDIR(sbuf.st_mode)
+    if (*pathbuf->s && !S_ISDIR(pge->ge_mode) &&
+	(Lstatat(pge, pathbuf->s, &sbuf) || !S_ISDIR(sbuf.st_mode)
 #ifdef S_IFLINK
 	     && ((globstar && !chase_symlinks) || !S_ISLNK(sbuf.st_mode))
 #endif
 	))
 	return 0;
 
-    if (!(dirp = Opendir(pathbuf->s))) {
+    if (pge->ge_dir != NULL)
+	dirp = NULL;
+    else if (!(dirp = Opendirat(pge, pathbuf->s))) {
 	/* todo: don't call for ENOENT or ENOTDIR? */
 	if ((pglob->gl_errfunc && (*pglob->gl_errfunc) (pathbuf->s, errno)) ||
 	    (pglob->gl_flags & GLOB_ERR))
@@ -616,43 +826,396 @@ glob3(struct strbuf *pathbuf, const Char *pattern, const Char *restpattern,
 	    return (0);
     }
 
+#ifdef GLOBAT
+    ge.ge_fd = dirp != NULL ? dirfd(dirp) : -1;
+#else
+    ge.ge_fd = -1;
+#endif
+    ge.ge_len = orig_len;
+    ops = globcomp(pattern, globstar ? termstar : restpattern, (int) m_not);
+
     /* search directory for matching names */
-    while ((dp = readdir(dirp)) != NULL) {
+    n = 0;
+    while ((name = globnext(dirp, pge->ge_dir, &n, &ge)) != NULL) {
 	/* initial DOT must be matched literally */
-	if (dp->d_name[0] == DOT && *pattern != DOT)
-	    if (!(pglob->gl_flags & GLOB_DOT) || !dp->d_name[1] ||
-		(dp->d_name[1] == DOT && !dp->d_name[2]))
+	if (name[0] == DOT && *pattern != DOT)
+	    if (!(pglob->gl_flags & GLOB_DOT) || !name[1] ||
+		(name[1] == DOT && !name[2]))
 		continue; /*unless globdot and not . or .. */
 	pathbuf->len = orig_len;
-	strbuf_append(pathbuf, dp->d_name);
+	strbuf_append(pathbuf, name);
 	strbuf_terminate(pathbuf);
 
 	if (globstar) {
 #ifdef S_IFLNK
-	    if (!chase_symlinks &&
-		(Lstat(pathbuf->s, &sbuf) || S_ISLNK(sbuf.st_mode)))
+	    if (!chase_symlinks && ge.ge_mode == 0) {
+		if (Lstatat(&ge, pathbuf->s, &sbuf))
 		    continue;
+		ge.ge_mode = sbuf.st_mode;
+	    }
+	    if (!chase_symlinks && S_ISLNK(ge.ge_mode))
+		continue;
+	    /* Nothing can be found under what is not a directory */
+	    if (ge.ge_mode != 0 && !S_ISDIR(ge.ge_mode) &&
+		!S_ISLNK(ge.ge_mode))
+		continue;
 #endif
-	    if (match(pathbuf->s + orig_len, pattern, termstar,
-		(int)m_not) == no_match) 
-		    continue;
+	    if (match(pathbuf->s + orig_len, ops) == no_match)
+		continue;
 	    strbuf_append1(pathbuf, SEP);
 	    strbuf_terminate(pathbuf);
-	    if ((err = glob2(pathbuf, pglobstar, pglob, no_match)) != 0)
+	    if (!S_ISDIR(ge.ge_mode)) {
+		ge.ge_mode = 0;
+		ge.ge_dir = NULL;
+	    }
+	    if ((err = glob2(pathbuf, pglobstar, pglob, no_match, &ge)) != 0)
 		break;
 	} else {
-	    if (match(pathbuf->s + orig_len, pattern, restpattern,
-		(int) m_not) == no_match)
+	    if (match(pathbuf->s + orig_len, ops) == no_match)
 		continue;
-	    if ((err = glob2(pathbuf, restpattern, pglob, no_match)) != 0)
+	    if ((err = glob2(pathbuf, restpattern, pglob, no_match, &ge)) != 0)
 		break;
 	}
     }
     /* todo: check error from readdir? */
-    closedir(dirp);
+    if (dirp != NULL)
+	closedir(dirp);
+    xfree(ops);
     return (err);
 }
 
+/*
+ * The next entry of the directory glob3() searches, from readdir() or
+ * from what was read ahead of it, with what is known about it in ge
+ */
+static const char *
+globnext(DIR *dirp, const struct globdir *gd, size_t *n, struct globent *ge)
+{
+    const struct globdirent *ent;
+    struct dirent *dp;
+
+    if (gd == NULL) {
+	if ((dp = readdir(dirp)) == NULL)
+	    return NULL;
+	ge->ge_mode = dirmode(dp);
+	ge->ge_dir = NULL;
+	return dp->d_name;
+    }
+    /* readdir() gives . and .. too, which a pattern starting with . sees */
+    if (*n < 2) {
+	ge->ge_mode = S_IFDIR;
+	ge->ge_dir = NULL;
+	return (*n)++ == 0 ? "." : "..";
+    }
+    if (*n - 2 >= gd->gd_nents)
+	return NULL;
+    ent = &gd->gd_ents[(*n)++ - 2];
+    ge->ge_mode = ent->gde_mode;
+    ge->ge_dir = globdirof(ent);
+    return ent->gde_name;
+}
+
+/*
+ * The entry called name among what was read of gd, NULL if there is none;
+ * the caller must then look for itself, as . and .. are never there and
+ * some file systems find names that readdir() spells differently.
+ */
+static const struct globdirent *
+globlookup(const struct globdir *gd, const char *name)
+{
+    return bsearch(name, gd->gd_ents, gd->gd_nents, sizeof(*gd->gd_ents),
+		   globnamecmp);
+}
+
+static int
+globnamecmp(const void *name, const void *ent)
+{
+    return strcmp(name, ((const struct globdirent *) ent)->gde_name);
+}
+
+#ifdef GLOBTHREADS
+static int
+globentcmp(const void *a, const void *b)
+{
+    return strcmp(((const struct globdirent *) a)->gde_name,
+		  ((const struct globdirent *) b)->gde_name);
+}
+
+/*
+ * Free a directory read ahead and all that was read below it
+ */
+static void
+globdirfree(struct globdir *gd)
+{
+    size_t i;
+
+    for (i = 0; i < gd->gd_nents; i++)
+	if (gd->gd_ents[i].gde_dir != NULL)
+	    globdirfree(gd->gd_ents[i].gde_dir);
+    free(gd->gd_path);
+    free(gd->gd_names);
+    free(gd->gd_ents);
+    free(gd);
+}
+
+/*
+ * Have gl_nthreads workers read the tree under path, and wait for them to
+ * finish.  Returns NULL if path itself could not be read.
+ */
+static struct globdir *
+globwalk(const char *path, const glob_t *pglob)
+{
+    struct globwalk gk;
+    struct globworker *gw;
+    struct globdir *gd;
+    sigset_t set, oset;
+    pthread_t *tid;
+    int nthreads, t;
+
+    if ((gd = calloc(1, sizeof(*gd))) == NULL)
+	return NULL;
+    if ((gd->gd_path = strdup(path)) == NULL) {
+	free(gd);
+	return NULL;
+    }
+    nthreads = pglob->gl_nthreads;
+    if (nthreads > GLOB_THREADSMAX)
+	nthreads = GLOB_THREADSMAX;
+    gk.gk_workers = xcalloc(nthreads, sizeof(*gk.gk_workers));
+    gk.gk_nworkers = nthreads;
+    gk.gk_dot = (pglob->gl_flags & GLOB_DOT) != 0;
+    gk.gk_pending = 0;
+    gk.gk_queued = 0;
+    (void) pthread_mutex_init(&gk.gk_lock, NULL);
+    (void) pthread_cond_init(&gk.gk_cond, NULL);
+    for (t = 0; t < nthreads; t++) {
+	gw = &gk.gk_workers[t];
+	gw->gw_walk = &gk;
+	(void) pthread_mutex_init(&gw->gw_lock, NULL);
+    }
+    /* If it cannot be queued, the workers just find nothing to do */
+    (void) globqueue(&gk.gk_workers[0], gd);
+
+    tid = xmalloc(nthreads * sizeof(*tid));
+    /* Signals are for the shell */
+    sigfillset(&set);
+    (void) pthread_sigmask(SIG_SETMASK, &set, &oset);
+    for (t = 0; t < nthreads; t++)
+	if (pthread_create(&tid[t], NULL, globworker, &gk.gk_workers[t]) != 0)
+	    break;
+    (void) pthread_sigmask(SIG_SETMASK, &oset, NULL);
+    /* The first worker does all there is if it is the only one */
+    if (t == 0)
+	(void) globworker(&gk.gk_workers[0]);
+    while (t-- > 0)
+	(void) pthread_join(tid[t], NULL);
+    xfree(tid);
+
+    for (t = 0; t < nthreads; t++) {
+	(void) pthread_mutex_destroy(&gk.gk_workers[t].gw_lock);
+	free(gk.gk_workers[t].gw_dirs);
+    }
+    (void) pthread_mutex_destroy(&gk.gk_lock);
+    (void) pthread_cond_destroy(&gk.gk_cond);
+    xfree(gk.gk_workers);
+    if (!gd->gd_done) {
+	globdirfree(gd);
+	return NULL;
+    }
+    return gd;
+}
+
+/*
+ * A worker: read directories from its own queue, or stolen from another
+ * worker's, until none are left queued or being read.
+ */
+static void *
+globworker(void *arg)
+{
+    struct globworker *gw = arg;
+    struct globwalk *gk = gw->gw_walk;
+    struct globdir *gd;
+    unsigned long queued;
+    int i, done;
+
+    for (;;) {
+	(void) pthread_mutex_lock(&gk->gk_lock);
+	queued = gk->gk_queued;
+	(void) pthread_mutex_unlock(&gk->gk_lock);
+
+	gd = globtake(gw, 0);
+	for (i = 1; gd == NULL && i < gk->gk_nworkers; i++)
+	    gd = globtake(&gk->gk_workers[(gw - gk->gk_workers + i) %
+					  gk->gk_nworkers], 1);
+	if (gd != NULL) {
+	    globreaddir(gw, gd);
+	    (void) pthread_mutex_lock(&gk->gk_lock);
+	    if (--gk->gk_pending == 0)
+		(void) pthread_cond_broadcast(&gk->gk_cond);
+	    (void) pthread_mutex_unlock(&gk->gk_lock);
+	    continue;
+	}
+
+	/* Nothing to take: wait until more is queued or all is read */
+	(void) pthread_mutex_lock(&gk->gk_lock);
+	while (gk->gk_pending != 0 && gk->gk_queued == queued)
+	    (void) pthread_cond_wait(&gk->gk_cond, &gk->gk_lock);
+	done = gk->gk_pending == 0;
+	(void) pthread_mutex_unlock(&gk->gk_lock);
+	if (done)
+	    return NULL;
+    }
+}
+
+/*
+ * Take the directory gw queued last, or with steal set the one it queued
+ * first, which is likely to have the most below it
+ */
+static struct globdir *
+globtake(struct globworker *gw, int steal)
+{
+    struct globdir *gd;
+
+    (void) pthread_mutex_lock(&gw->gw_lock);
+    if (gw->gw_first == gw->gw_last)
+	gd = NULL;
+    else if (steal)
+	gd = gw->gw_dirs[gw->gw_first++];
+    else
+	gd = gw->gw_dirs[--gw->gw_last];
+    if (gw->gw_first == gw->gw_last)
+	gw->gw_first = gw->gw_last = 0;
+    (void) pthread_mutex_unlock(&gw->gw_lock);
+    return gd;
+}
+
+/*
+ * Read the entries of gd, and queue its subdirectories for gw to read
+ * in turn.  No shell function may be called from here.
+ */
+static void
+globreaddir(struct globworker *gw, struct globdir *gd)
+{
+    DIR    *dirp;
+    struct dirent *dp;
+    struct globdirent *ent;
+    struct globdir *sub;
+#ifdef GLOBAT
+    struct stat st;
+#endif
+    size_t len, plen, i, nameslen = 0, namessize = 0, entssize = 0;
+    void   *p;
+
+    if ((dirp = opendir(*gd->gd_path ? gd->gd_path : ".")) == NULL)
+	return;
+    while ((dp = readdir(dirp)) != NULL) {
+	if (dp->d_name[0] == DOT &&
+	    (dp->d_name[1] == EOS ||
+	     (dp->d_name[1] == DOT && dp->d_name[2] == EOS)))
+	    continue;
+	len = strlen(dp->d_name) + 1;
+	if (nameslen + len > namessize) {
+	    if ((p = realloc(gd->gd_names, (nameslen + len) * 2)) == NULL)
+		break;
+	    gd->gd_names = p;
+	    namessize = (nameslen + len) * 2;
+	}
+	if (gd->gd_nents == entssize) {
+	    if ((p = realloc(gd->gd_ents,
+			     (entssize * 2 + 64) * sizeof(*ent))) == NULL)
+		break;
+	    gd->gd_ents = p;
+	    entssize = entssize * 2 + 64;
+	}
+	(void) memcpy(&gd->gd_names[nameslen], dp->d_name, len);
+	ent = &gd->gd_ents[gd->gd_nents++];
+	ent->gde_off = nameslen;
+	ent->gde_dir = NULL;
+	ent->gde_mode = dirmode(dp);
+#ifdef GLOBAT
+	if (ent->gde_mode == 0 &&
+	    fstatat(dirfd(dirp), dp->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+	    ent->gde_mode = st.st_mode;
+#endif /* GLOBAT */
+	nameslen += len;
+    }
+    (void) closedir(dirp);
+    if (dp != NULL)
+	return;
+
+    for (i = 0; i < gd->gd_nents; i++)
+	gd->gd_ents[i].gde_name = &gd->gd_names[gd->gd_ents[i].gde_off];
+    qsort(gd->gd_ents, gd->gd_nents, sizeof(*gd->gd_ents), globentcmp);
+    gd->gd_done = 1;
+
+    /* What glob3() would go down into, as long as there is memory */
+    plen = strlen(gd->gd_path);
+    for (i = 0; i < gd->gd_nents; i++) {
+	ent = &gd->gd_ents[i];
+	if (!S_ISDIR(ent->gde_mode) ||
+	    (ent->gde_name[0] == DOT && !gw->gw_walk->gk_dot))
+	    continue;
+	len = strlen(ent->gde_name);
+	if ((sub = calloc(1, sizeof(*sub))) == NULL)
+	    break;
+	if ((sub->gd_path = malloc(plen + len + 2)) == NULL) {
+	    free(sub);
+	    break;
+	}
+	(void) memcpy(sub->gd_path, gd->gd_path, plen);
+	(void) memcpy(&sub->gd_path[plen], ent->gde_name, len);
+	sub->gd_path[plen + len] = SEP;
+	sub->gd_path[plen + len + 1] = EOS;
+	if (globqueue(gw, sub) == -1) {
+	    globdirfree(sub);
+	    break;
+	}
+	ent->gde_dir = sub;
+    }
+}
+
+/*
+ * Queue gd for gw to read, or return -1 if there is no room.  It counts
+ * as pending before another worker can take it, so that the count does
+ * not run out while the directory it is in is still being read.
+ */
+static int
+globqueue(struct globworker *gw, struct globdir *gd)
+{
+    struct globwalk *gk = gw->gw_walk;
+    struct globdir **dirs;
+    size_t n;
+
+    (void) pthread_mutex_lock(&gw->gw_lock);
+    if (gw->gw_last == gw->gw_size) {
+	n = gw->gw_last - gw->gw_first;
+	if (gw->gw_first != 0) {
+	    (void) memmove(gw->gw_dirs, &gw->gw_dirs[gw->gw_first],
+			   n * sizeof(*dirs));
+	    gw->gw_first = 0;
+	    gw->gw_last = n;
+	}
+	else {
+	    n = gw->gw_size * 2 + 16;
+	    if ((dirs = realloc(gw->gw_dirs, n * sizeof(*dirs))) == NULL) {
+		(void) pthread_mutex_unlock(&gw->gw_lock);
+		return -1;
+	    }
+	    gw->gw_dirs = dirs;
+	    gw->gw_size = n;
+	}
+    }
+    (void) pthread_mutex_lock(&gk->gk_lock);
+    gk->gk_pending++;
+    gk->gk_queued++;
+    (void) pthread_cond_signal(&gk->gk_cond);
+    (void) pthread_mutex_unlock(&gk->gk_lock);
+    gw->gw_dirs[gw->gw_last++] = gd;
+    (void) pthread_mutex_unlock(&gw->gw_lock);
+    return 0;
+}
+#endif /* GLOBTHREADS */
+
 
 /*
  * Extend the gl_pathv member of a glob_t structure to accomodate a new item,
@@ -691,29 +1254,82 @@ globextend(const char *path, glob_t *pglob)
 }
 
 /*
- * pattern matching function for filenames.  Each occurrence of the *
- * pattern causes a recursion level.
+ * Decode the pattern from pat to patend, so that match() need not do it
+ * again for every name
  */
-static  int
-match(const char *name, const Char *pat, const Char *patend, int m_not)
+static struct globop *
+globcomp(const Char *pat, const Char *patend, int m_not)
 {
-    int ok, negate_range;
+    struct globop *ops, *op, *set;
+    __Char wc;
     Char c;
 
+    op = ops = xmalloc((patend - pat + 1) * sizeof(*ops));
     while (pat < patend) {
-	size_t lwk;
-	__Char wc, wk;
-
 	c = *pat; /* Only for M_MASK bits */
 	pat += One_Char_mbtowc(&wc, pat, MB_LEN_MAX);
-	lwk = one_mbtowc(&wk, name, MB_LEN_MAX);
 	switch (c & M_MASK) {
 	case M_ALL:
 	    while (pat < patend && (*pat & M_MASK) == M_ALL)  /* eat consecutive '*' */
 		pat += One_Char_mbtowc(&wc, pat, MB_LEN_MAX);
-	    if (pat == patend)
+	    op++->go_op = M_ALL;
+	    break;
+	case M_ONE:
+	    op++->go_op = M_ONE;
+	    break;
+	case M_SET:
+	    set = op++;
+	    set->go_op = M_SET;
+	    set->go_c = (*pat & M_MASK) == m_not;
+	    set->go_c2 = 0;
+	    if (set->go_c)
+		++pat;
+	    while ((*pat & M_MASK) != M_END) {
+		pat += One_Char_mbtowc(&op->go_c, pat, MB_LEN_MAX);
+		if ((*pat & M_MASK) == M_RNG) {
+		    pat++;
+		    pat += One_Char_mbtowc(&op->go_c2, pat, MB_LEN_MAX);
+		    op->go_op = M_RNG;
+		} else
+		    op->go_op = 0;
+		op++;
+		set->go_c2++;
+	    }
+	    pat += One_Char_mbtowc(&wc, pat, MB_LEN_MAX);
+	    break;
+	default:
+	    op->go_op = 0;
+	    op++->go_c = samecase(wc);
+	    break;
+	}
+    }
+    op->go_op = M_END;
+    return ops;
+}
+
+/*
+ * pattern matching function for filenames.  Each occurrence of the *
+ * pattern causes a recursion level.
+ */
+static  int
+match(const char *name, const struct globop *op)
+{
+    const struct globop *set;
+    int ok;
+    __Char n;
+
+    for (;; op++) {
+	size_t lwk;
+	__Char wk;
+
+	lwk = one_mbtowc(&wk, name, MB_LEN_MAX);
+	switch (op->go_op) {
+	case M_END:
+	    return (*name == EOS);
+	case M_ALL:
+	    if (op[1].go_op == M_END)
 	        return (1);
-	    while (!match(name, pat, patend, m_not)) {
+	    while (!match(name, op + 1)) {
 		if (*name == EOS)
 		    return (0);
 		name += lwk;
@@ -726,37 +1342,31 @@ match(const char *name, const Char *pat, const Char *patend, int m_not)
 	    name += lwk;
 	    break;
 	case M_SET:
-	    ok = 0;
 	    if (*name == EOS)
 		return (0);
 	    name += lwk;
-	    if ((negate_range = ((*pat & M_MASK) == m_not)) != 0)
-		++pat;
-	    while ((*pat & M_MASK) != M_END) {
-		pat += One_Char_mbtowc(&wc, pat, MB_LEN_MAX);
-		if ((*pat & M_MASK) == M_RNG) {
-		    __Char wc2;
-
-		    pat++;
-		    pat += One_Char_mbtowc(&wc2, pat, MB_LEN_MAX);
-		    if (globcharcoll(wc, wk, 0) <= 0 &&
-			globcharcoll(wk, wc2, 0) <= 0)
-			ok = 1;
-		} else if (wc == wk)
-		    ok = 1;
+	    ok = 0;
+	    set = op;
+	    for (n = set->go_c2; n > 0; n--) {
+		op++;
+		if (ok)
+		    continue;
+		if (op->go_op == M_RNG)
+		    ok = globcharcoll(op->go_c, wk, 0) <= 0 &&
+			globcharcoll(wk, op->go_c2, 0) <= 0;
+		else
+		    ok = op->go_c == wk;
 	    }
-	    pat += One_Char_mbtowc(&wc, pat, MB_LEN_MAX);
-	    if (ok == negate_range)
+	    if (ok == set->go_c)
 		return (0);
 	    break;
 	default:
-	    if (*name == EOS || samecase(wk) != samecase(wc))
+	    if (*name == EOS || samecase(wk) != op->go_c)
 		return (0);
 	    name += lwk;
 	    break;
 	}
     }
-    return (*name == EOS);
 }
 
 /* free allocated data belonging to a glob_t structure */
@@ -56,8 +56,11 @@ typedef struct {
 	void *(*gl_opendir) (const char *);
 	int (*gl_lstat) (const char *, struct stat *);
 	int (*gl_stat) (const char *, struct stat *);
+	int gl_nthreads;	/* Threads to read ** trees with (tcsh) */
 } glob_t;
 
+#define	GLOB_THREADSDEF	4	/* gl_nthreads if globthreads has no value */
+
 #define	GLOB_APPEND	0x0001	/* Append to output from previous call. */
 #define	GLOB_DOOFFS	0x0002	/* Use gl_offs. */
 #define	GLOB_ERR	0x0004	/* Return on error. */
@@ -1637,17 +1637,24 @@ st_save(struct saved_state *st, int unit, int hflg, Char **al, Char **av)
     st->av = av;
 
     SHIN	= unit;	/* Do this first */
+    arginp	= 0;	/* And these before settell() looks at them */
+    onelflg	= 0;
+    intty	= isatty(SHIN);
 
     /* Establish new input arena */
     {
 	fbuf = NULL;
 	fseekp = feobp = fblocks = 0;
+	fmapped = 0;
+#ifdef WIDE_STRINGS
+	fmlens = NULL;
+#endif
+	floop = NULL;
+	fsrch = NULL;
+	fcomp = NULL;
 	settell();
     }
 
-    arginp	= 0;
-    onelflg	= 0;
-    intty	= isatty(SHIN);
     whyles	= 0;
     gointr	= 0;
     evalvec	= 0;
@@ -1684,6 +1691,12 @@ st_restore(void *xst)
 	for (i = 0; i < nfblocks; i++)
 	    xfree(nfbuf[i]);
 	xfree(nfbuf);
+#ifdef WIDE_STRINGS
+	xfree(fmlens);
+#endif
+	loopfree();
+	srchfree();
+	compfree();
     }
     cpybin(B, st->B);
 
@@ -1750,6 +1763,7 @@ srcunit(int unit, int onlyown, int hflg, Char **av)
 
     /* Save the current state and move us to a new state */
     st_save(&st, unit, hflg, NULL, av);
+    compload();
 
     /*
      * Now if we are allowing commands to be interrupted, we let ourselves be
@@ -2024,6 +2038,7 @@ process(int catch)
 	    chkstop--;
 	if (neednote)
 	    pnote();
+	hashwatch();
 	if (intty && prompt && evalvec == 0) {
 	    just_signaled = 0;
 	    mailchk();
@@ -2059,7 +2074,23 @@ process(int catch)
 	if (setintr)
 	    pintr_push_enable(&old_pintr_disabled);
 	freelex(&paraml);
-	hadhist = lex(&paraml);
+	/*
+	 * Lines of a loop body we have been through before come back
+	 * already parsed
+	 */
+	if (loophit(&t)) {
+	    if (setintr)
+		cleanup_until(&old_pintr_disabled);
+	    cleanup_push(&paraml, lex_cleanup);
+	    alrmcatch_disabled = 1;
+	    goto cmd_exec;
+	}
+	if (comphit(&paraml))
+	    hadhist = 0;
+	else {
+	    hadhist = lex(&paraml);
+	    compsave(&paraml);
+	}
 	if (setintr)
 	    cleanup_until(&old_pintr_disabled);
 	cleanup_push(&paraml, lex_cleanup);
@@ -2144,7 +2175,9 @@ process(int catch)
 	    freesyn(t);
 	    stderror(ERR_OLD);
 	}
+	loopsave(t);
 
+    cmd_exec:
 	postcmd();
 	/*
 	 * Execute the parse tree From: Michael Schroeder
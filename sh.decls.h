@@ -117,6 +117,10 @@ extern	void		  dohash	(Char **, struct command *);
 extern	void		  dounhash	(Char **, struct command *);
 extern	void		  execash	(Char **, struct command *);
 extern	void		  hashstat	(Char **, struct command *);
+extern	void		  hashwatch	(void);
+extern	void		  hashunwatch	(void);
+extern	char		 *hashpath	(Char *);
+extern	void		  execflush	(void);
 extern	void		  xechoit	(Char **);
 extern	int		  executable	(const Char *, const Char *, int);
 extern	int		  tellmewhat	(struct wordent *, Char **);
@@ -127,6 +131,8 @@ extern	int		  find_cmd	(Char *, int);
  * sh.exp.c
  */
 extern  Char		 *filetest      (Char *, Char ***, int);
+extern	void		  ftbegin	(void);
+extern	void		  ftflush	(void);
 extern	tcsh_number_t 	  expr		(Char ***);
 extern	tcsh_number_t	  exp0		(Char ***, int);
 
@@ -140,6 +146,7 @@ extern	size_t		  tenex		(Char *, size_t);
 /*
  * sh.func.c
  */
+extern	Char		**envfind	(const Char *);
 extern	void		  tsetenv	(const Char *, const Char *);
 extern	void		  Unsetenv	(Char *);
 extern	void		  doalias	(Char **, struct command *);
@@ -196,6 +203,7 @@ extern	Char		 *globone	(Char *, int);
 extern	int		  Gmatch	(const Char *, const Char *);
 extern	int		  Gnmatch	(const Char *, const Char *,
 					 const Char **);
+extern	void		  gmatchflush	(void);
 extern	Char		**globall	(Char **, int);
 extern	Char		**glob_all_or_error(Char **);
 extern	void		  rscan		(Char **, void (*)(Char));
@@ -224,6 +232,9 @@ extern	void		  rechist	(Char *, int);
 extern	void		  loadhist	(Char *, int);
 extern	void		  displayHistStats(const char *);
 extern	void		  sethistory	(int);
+extern	int		  histgramset	(const Char *, int);
+extern	struct Hist	 *histgramnext	(struct Hist *);
+extern	struct Hist	 *histgramprev	(struct Hist *);
 
 /*
  * sh.init.c
@@ -237,15 +248,27 @@ extern	void		  addla		(Char *);
 extern	void		  bseek		(struct Ain *);
 extern	void		  btell		(struct Ain *);
 extern	void		  btoeof	(void);
+extern	void		  compfree	(void);
+extern	int		  comphit	(struct wordent *);
+extern	void		  compload	(void);
+extern	void		  compsave	(struct wordent *);
 extern	void		  copylex	(struct wordent *, struct wordent *);
 extern	Char		 *domod		(Char *, Char);
 extern	void		  initlex	(struct wordent *);
 extern	void		  freelex	(struct wordent *);
+extern	void		  freewordent	(struct wordent *);
 extern	int		  lex		(struct wordent *);
 extern	void		  lex_cleanup	(void *);
+extern	struct wordent	 *newwordent	(void);
+extern	void		  loopfree	(void);
+extern	int		  loophit	(struct command **);
+extern	void		  loopsave	(struct command *);
 extern	void		  prlex		(struct wordent *);
 extern	eChar		  readc		(int);
 extern	void		  settell	(void);
+extern	void		  srchfree	(void);
+extern	int		  srchhit	(int, const Char *, int *);
+extern	void		  srchsave	(int, const Char *, int);
 extern	void		  unreadc	(Char);
 extern	ssize_t		  wide_read	(int, Char *, size_t, int);
 
@@ -305,6 +328,7 @@ extern	ssize_t		  xwrite	(int, const void *, size_t);
  * sh.parse.c
  */
 extern	void		  alias		(struct wordent *);
+extern struct command	 *copysyn	(const struct command *);
 extern	void		  freesyn	(struct command *);
 extern struct command 	 *syntax	(const struct wordent *,
 					 const struct wordent *, int);
@@ -1208,6 +1208,8 @@ dnewcwd(struct directory *dp, int dflag)
     dcwd = dp;
     dset(dcwd->di_name);
     dgetstack();
+    execflush();		/* relative names mean something else now */
+    ftflush();
     print = printd;		/* if printd is set, print dirstack... */
     if (adrof(STRpushdsilent))	/* but pushdsilent overrides printd... */
 	print = 0;
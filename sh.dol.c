@@ -356,7 +356,8 @@ quotspec:
 
 static Char *nulvec[] = { NULL };
 static struct varent nulargv = {nulvec, STRargv, VAR_READWRITE, 
-				{ NULL, NULL, NULL }, 0 };
+				{ NULL, NULL, NULL }, 0, NULL, 0, 0, NULL,
+				0, 0 };
 
 static void
 dolerror(Char *s)
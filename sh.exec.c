@@ -48,6 +48,24 @@ RCSID("$tcsh$")
 # define FASTHASH	/* Fast hashing is the default */
 #endif /* OLDHASH */
 
+#if defined(FASTHASH) && defined(HAVE_SYS_INOTIFY_H)
+# define PATHWATCH	/* Incremental rehash of watched path directories */
+# include <sys/inotify.h>
+#endif /* FASTHASH && HAVE_SYS_INOTIFY_H */
+
+#if defined(FASTHASH) && !defined(WINNT_NATIVE)
+# define HASHSNAP	/* Keep a snapshot of the hash table in $hashfile */
+# include <stdio.h>	/* for rename(2), grr. */
+# ifdef HAVE_MMAP
+#  include <sys/mman.h>
+# endif /* HAVE_MMAP */
+/* The workers call opendir(), so they need a thread safe malloc() */
+# if defined(HAVE_PTHREAD_H) && defined(SYSMALLOC)
+#  define HASHTHREADS	/* Read path directories in $hashthreads threads */
+#  include <pthread.h>
+# endif /* HAVE_PTHREAD_H && SYSMALLOC */
+#endif /* FASTHASH && !WINNT_NATIVE */
+
 /*
  * System level search and execute of a command.
  * We look in each directory for the specified command name.
@@ -75,44 +93,193 @@ static Char *expath;		/* Path for exerr */
 
 #ifdef FASTHASH
 /*
- * xhash is an array of hash buckets which are used to hash execs.  If
- * it is allocated (havhash true), then to tell if ``name'' is
- * (possibly) present in the i'th component of the variable path, look
- * at the [hashname(name)] bucket of size [hashwidth] bytes, in the [i
- * mod size*8]'th bit.  The cache size is defaults to a length of 1024
- * buckets, each 1 byte wide.  This implementation guarantees that
- * objects n bytes wide will be aligned on n byte boundaries.
+ * xhash is an open addressed hash table of the commands found in the
+ * absolute components of the variable path.  There is one entry for
+ * each (name, component) pair, holding the index of the component and
+ * the inode number and file type that readdir() reported, so a name
+ * present in several directories has several entries.  hashfind()
+ * returns the first component at or after a given index that holds a
+ * name, which lets doexec() and iscommand() go straight to the right
+ * directory instead of trying every component that might hold it.
+ * The table starts with 1024 slots (or the length given to rehash)
+ * and doubles whenever it becomes half full.  The names live in the
+ * hashnames pool, so building the table costs no allocation per entry.
  */
 # define HSHMUL		241
 
-static unsigned long *xhash = NULL;
-static unsigned int hashlength = 0, uhashlength = 0;
-static unsigned int hashwidth = 0, uhashwidth = 0;
+struct hashent {
+    size_t  he_name;		/* Offset in hashnames, 0 if the slot is free */
+    unsigned int he_hash;	/* hashname() of the name */
+    int     he_dir;		/* Index of the path component */
+    ino_t   he_ino;		/* Inode number from readdir() */
+    mode_t  he_mode;		/* File type from readdir(), 0 if unknown */
+};
+
+static struct hashent *xhash = NULL;
+static unsigned int hashlength = 0, uhashlength = 0, hashused = 0;
+static unsigned int hashshift = 0;	/* 32 - log2(hashlength) */
+static Char *hashnames = NULL;
+static size_t hashnameslen = 0, hashnamessize = 0;
+static unsigned long hashlookups = 0, hashlookprobes = 0;
 static int hashdebug = 0;
 
-# define hash(a, b)	(((a) * HSHMUL + (b)) % (hashlength))
-# define widthof(t)	(sizeof(t) * BITS_PER_BYTE)
-# define tbit(f, i, t)	(((t *) xhash)[(f)] &  \
-			 (1UL << (i & (widthof(t) - 1))))
-# define tbis(f, i, t)	(((t *) xhash)[(f)] |= \
-			 (1UL << (i & (widthof(t) - 1))))
-# define cbit(f, i)	tbit(f, i, unsigned char)
-# define cbis(f, i)	tbis(f, i, unsigned char)
-# define sbit(f, i)	tbit(f, i, unsigned short)
-# define sbis(f, i)	tbis(f, i, unsigned short)
-# define ibit(f, i)	tbit(f, i, unsigned int)
-# define ibis(f, i)	tbis(f, i, unsigned int)
-# define lbit(f, i)	tbit(f, i, unsigned long)
-# define lbis(f, i)	tbis(f, i, unsigned long)
-
-# define bit(f, i) (hashwidth==sizeof(unsigned char)  ? cbit(f,i) : \
- 		    ((hashwidth==sizeof(unsigned short) ? sbit(f,i) : \
-		     ((hashwidth==sizeof(unsigned int)   ? ibit(f,i) : \
-		     lbit(f,i))))))
-# define bis(f, i) (hashwidth==sizeof(unsigned char)  ? cbis(f,i) : \
- 		    ((hashwidth==sizeof(unsigned short) ? sbis(f,i) : \
-		     ((hashwidth==sizeof(unsigned int)   ? ibis(f,i) : \
-		     lbis(f,i))))))
+# define hash(a, b)	((a) * HSHMUL + (b))
+# define hashslot(h)	((((h) * 0x9e3779b1U) & 0xffffffffU) >> hashshift)
+# define hashnext(s)	(((s) + 1) & (hashlength - 1))
+# define hashentname(he) (&hashnames[(he)->he_name])
+
+# if defined(DT_UNKNOWN) && defined(DTTOIF)
+#  define dirmode(dp)	((dp)->d_type == DT_UNKNOWN ? 0 : DTTOIF((dp)->d_type))
+# else
+#  define dirmode(dp)	0
+# endif
+
+static	void	hashresize	(unsigned int);
+static	void	hashenter	(Char *, int, ino_t, mode_t);
+static	int	hashfind	(Char *, int, int, struct hashent **);
+
+# ifdef PATHWATCH
+/*
+ * If pathwatch is set, dohash() puts an inotify watch on each absolute
+ * component of path before reading it; the watches share descriptor
+ * FSHWATCH.  hashwatch() reads the pending events and adds or removes
+ * just the names that changed, so the table stays current without
+ * rereading every directory.  hashwd[i] is the watch descriptor of the
+ * i'th component or -1; a directory listed twice shares its watch.
+ */
+#  define HASHWATCHMASK	(IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+			 IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | \
+			 IN_ONLYDIR)
+
+static int *hashwd = NULL;
+static int hashnwd = 0;
+static pid_t hashwatchpid;
+static size_t hashnamesfree = 0;	/* Space of removed names in hashnames */
+
+static	void	hashdelete	(unsigned int);
+static	void	hashremove	(Char *, int);
+static	void	hashremovedir	(int);
+static	void	hashcompact	(void);
+# endif /* PATHWATCH */
+
+# ifdef HASHSNAP
+/*
+ * If hashfile is set, dohash() keeps in that file a snapshot of the
+ * names it read from each directory, so that other shells with the
+ * same directories in their path load the names from the snapshot
+ * instead of reading the directories again.  A record is used only if
+ * its directory still has the same device, inode number and
+ * modification time, and was not modified around the time it was
+ * read; this costs one stat() per directory.  The file is mapped
+ * read-only where possible, and any shell that had to read a directory
+ * writes a new snapshot and renames it into place.  All numbers are in
+ * host byte order; a snapshot from another kind of host is ignored.
+ */
+#  define HASHSNAPMAGIC	"tcshhsh"
+#  define HASHSNAPVERSION 1
+#  define HASHSNAPMAXDIRS 256	/* Most records kept */
+#  define HASHSNAPSLACK	2	/* Seconds a directory must be older than
+				 * its record, to allow for slow clocks */
+#  define HASHSNAPALIGN(n) (((n) + 7) & ~(size_t) 7)
+
+struct hashsnap {		/* The header of the file */
+    char     hs_magic[8];
+    uint32_t hs_version;
+    uint32_t hs_ndirs;
+    uint64_t hs_size;		/* Of the whole file */
+};
+
+struct hashsnapdir {		/* The record of one directory, followed by */
+    uint32_t hd_size;		/* its path and its names; a multiple of 8 */
+    uint32_t hd_pathlen;	/* With the terminating NUL */
+    uint32_t hd_nnames;
+    uint32_t hd_pad;
+    uint64_t hd_dev;
+    uint64_t hd_ino;
+    int64_t  hd_mtime;
+    int64_t  hd_readtime;	/* When the directory was read */
+};
+
+struct hashsnapname {		/* One name, followed by its characters */
+    uint64_t hn_ino;
+    uint32_t hn_mode;
+    uint32_t hn_len;
+};
+
+struct hashsnapstate {
+    char   *map;		/* The old snapshot, or NULL */
+    size_t  size;
+    int     mapped;		/* Whether map came from mmap() */
+    struct strbuf new;		/* The records of the new snapshot */
+    uint32_t ndirs;		/* Number of records in new */
+    uint32_t nnames;		/* Number of names in the record being made */
+};
+
+static int hashsnapdirs = 0;	/* Directories loaded from the snapshot */
+static int hashreaddirs = 0;	/* Directories read by the last dohash() */
+
+static	void	hashsnapopen	(struct hashsnapstate *, const char *);
+static	void	hashsnap_cleanup (void *);
+static	const char *hashsnapnext (const char *, size_t, const char *,
+				  struct hashsnapdir *);
+static	const char *hashsnapfind (const char *, size_t, const char *,
+				  struct hashsnapdir *);
+static	void	hashsnapload	(const char *, const struct hashsnapdir *,
+				 int);
+static	const char *hashsnapfresh (struct hashsnapstate *, const char *,
+				   const struct stat *, struct hashsnapdir *);
+static	int	hashsnapuse	(struct hashsnapstate *, const char *, int,
+				 const struct stat *);
+static	size_t	hashsnapbegin	(struct hashsnapstate *, const char *,
+				 const struct stat *);
+static	void	hashsnapname	(struct hashsnapstate *, const char *, ino_t,
+				 mode_t);
+static	void	hashsnapend	(struct hashsnapstate *, size_t);
+static	void	hashsnapwrite	(struct hashsnapstate *, const char *);
+# endif /* HASHSNAP */
+
+# ifdef HASHTHREADS
+/*
+ * If hashthreads is set, dohash() first has that many worker threads
+ * read the absolute components of path at the same time, which pays
+ * off when the directories are slow to read, as automounted ones are.
+ * The workers only collect the entries, using nothing but the system
+ * malloc(); dohash() then enters them in path order just as if it had
+ * read the directories itself, so precedence does not change.
+ */
+#  define HASHTHREADSDEF 4	/* Workers if hashthreads has no value */
+#  define HASHTHREADSMAX 64
+
+struct hashscanent {
+    size_t  hse_name;		/* Offset in hs_names */
+    ino_t   hse_ino;
+    mode_t  hse_mode;
+};
+
+struct hashscan {		/* One component of path */
+    char   *hs_dir;		/* NULL if the workers skip it */
+    char   *hs_names;		/* The names, each ending in a NUL */
+    size_t  hs_nameslen, hs_namessize;
+    struct hashscanent *hs_ents;
+    size_t  hs_nents, hs_entssize;
+    int     hs_done;		/* Whether the whole directory was read */
+};
+
+static struct hashscan *hashscans = NULL;
+static size_t hashnscans = 0, hashnextscan = 0;
+static pthread_mutex_t hashscanlock = PTHREAD_MUTEX_INITIALIZER;
+static int hashscanthreads = 0;	/* Workers of the last dohash() */
+static int hashscandirs = 0;	/* Directories they read */
+static unsigned long hashscanusec = 0, hashmergeusec = 0;
+
+static	void	*hashscanner	(void *);
+static	int	 hashscandir	(struct hashscan *);
+static	void	 hashscanstart	(Char **, struct hashsnapstate *);
+static	void	 hashscan_cleanup (void *);
+static	void	 hashscanmerge	(struct hashscan *, int,
+				 struct hashsnapstate *);
+static	unsigned long hashusec	(const struct timeval *);
+# endif /* HASHTHREADS */
 #else /* OLDHASH */
 /*
  * Xhash is an array of HSHSIZ bits (HSHSIZ / 8 chars), which are used
@@ -141,8 +308,35 @@ static int hits, misses;
 /* Dummy search path for just absolute search when no path */
 static Char *justabs[] = {STRNULL, 0};
 
+#ifndef WINNT_NATIVE
+/*
+ * executable() keeps its answers in a small direct mapped cache, so
+ * that the commands looked up again and again by which, where, spelling
+ * correction and completion cost no system call.  An entry is good only
+ * for the generation it was made in; execflush() starts a new one on
+ * anything that may change the answers: a rehash, a change of path or
+ * of the current directory, or a change seen by hashwatch().  Names under
+ * a relative directory of path, which nothing watches, are not cached.
+ */
+# define EXECCACHESIZE	256	/* A power of 2 */
+
+struct execcache {
+    char   *ec_path;		/* NULL if the slot was never used */
+    unsigned int ec_gen;
+    mode_t  ec_mode;		/* 0 if stat() failed */
+    int     ec_xok;		/* Whether we may execute it */
+};
+
+static struct execcache execcache[EXECCACHESIZE];
+static unsigned int execgen = 1;
+static unsigned long execlookups = 0, execstats = 0;
+#endif /* !WINNT_NATIVE */
+
 static	void	pexerr		(void) __attribute__((__noreturn__));
 static	void	texec		(Char *, Char **);
+#ifndef WINNT_NATIVE
+static	void	hashdirent	(char *, int, ino_t, mode_t);
+#endif /* !WINNT_NATIVE */
 int	hashname	(Char *);
 static	int 	iscommand	(Char *);
 
@@ -153,6 +347,9 @@ doexec(struct command *t, int do_glob)
     struct varent *v;
     int slash, gflag, rehashed;
     int hashval, i;
+#ifdef FASTHASH
+    int hashdir;
+#endif /* FASTHASH */
     Char   *blk[2];
 
     /*
@@ -268,6 +465,9 @@ doexec(struct command *t, int do_glob)
 retry:
     pv = opv;
     i = 0;
+#ifdef FASTHASH
+    hashdir = havhash ? hashfind(*av, hashval, 0, NULL) : -1;
+#endif /* FASTHASH */
 #ifdef VFORK
     hits++;
 #endif /* VFORK */
@@ -280,8 +480,9 @@ retry:
 	 */
 	if (!slash && ABSOLUTEP(pv[0]) && havhash) {
 #ifdef FASTHASH
-	    if (!bit(hashval, i))
+	    if (i != hashdir)
 		goto cont;
+	    hashdir = hashfind(*av, hashval, i + 1, NULL);
 #else /* OLDHASH */
 	    int hashval1 = hash(hashval, i);
 	    if (!bit(xhash, hashval1))
@@ -633,11 +834,62 @@ xechoit(Char **t)
     }
 }
 
+#ifndef WINNT_NATIVE
+/*
+ * Enter the directory entry name of the i'th component of path.
+ */
+static void
+hashdirent(char *name, int i, ino_t ino, mode_t mode)
+{
+#ifndef FASTHASH
+    int hashval;
+#endif /* !FASTHASH */
+
+    USE(ino);
+    USE(mode);
+#if defined(_UWIN) || defined(__CYGWIN__)
+    /* Turn foo.{exe,com,bat} into foo since UWIN's readdir returns
+     * the file with the .exe, .com, .bat extension
+     *
+     * Same for Cygwin, but only for .exe and .com extension.
+     */
+    {
+	ssize_t	ext = strlen(name) - 4;
+	if ((ext > 0) && (strcasecmp(&name[ext], ".exe") == 0 ||
+#ifndef __CYGWIN__
+			  strcasecmp(&name[ext], ".bat") == 0 ||
+#endif
+			  strcasecmp(&name[ext], ".com") == 0)) {
+#ifdef __CYGWIN__
+	    /* Also store the variation with extension. */
+# ifdef FASTHASH
+	    hashenter(str2short(name), i, ino, mode);
+# else /* OLDHASH */
+	    hashval = hash(hashname(str2short(name)), i);
+	    bis(xhash, hashval);
+# endif /* FASTHASH */
+#endif /* __CYGWIN__ */
+	    name[ext] = '\0';
+	}
+    }
+#endif /* _UWIN || __CYGWIN__ */
+#ifdef FASTHASH
+    hashenter(str2short(name), i, ino, mode);
+    if (hashdebug & 1)
+	xprintf(CGETS(13, 1, "hash=%-4d dir=%-2d prog=%s\n"),
+		hashname(str2short(name)), i, name);
+#else /* OLD HASH */
+    hashval = hash(hashname(str2short(name)), i);
+    bis(xhash, hashval);
+#endif /* FASTHASH */
+}
+#endif /* !WINNT_NATIVE */
+
 /*ARGSUSED*/
 void
 dohash(Char **vv, struct command *c)
 {
-#ifdef COMMENT
+#if defined(COMMENT) || defined(HASHSNAP)
     struct stat stb;
 #endif
     DIR    *dirp;
@@ -645,52 +897,60 @@ dohash(Char **vv, struct command *c)
     int     i = 0;
     struct varent *v = adrof(STRpath);
     Char  **pv;
-    int hashval;
+#ifdef HASHSNAP
+    struct hashsnapstate snap;
+    Char *snapfile = STRNULL;
+    size_t snapdir = 0;
+#endif /* HASHSNAP */
+#ifdef HASHTHREADS
+    struct timeval t0;
+#endif /* HASHTHREADS */
 #ifdef WINNT_NATIVE
     int is_windir; /* check if it is the windows directory */
-    USE(hashval);
 #endif /* WINNT_NATIVE */
 
     USE(c);
+    execflush();
 #ifdef FASTHASH
     if (vv && vv[1]) {
         uhashlength = atoi(short2str(vv[1]));
-        if (vv[2]) {
-	    uhashwidth = atoi(short2str(vv[2]));
-	    if ((uhashwidth != sizeof(unsigned char)) && 
-	        (uhashwidth != sizeof(unsigned short)) && 
-	        (uhashwidth != sizeof(unsigned long)))
-	        uhashwidth = 0;
-	    if (vv[3])
-		hashdebug = atoi(short2str(vv[3]));
-        }
+	/* The second argument used to give the width of the hash buckets */
+        if (vv[2] && vv[3])
+	    hashdebug = atoi(short2str(vv[3]));
     }
 
-    if (uhashwidth)
-	hashwidth = uhashwidth;
-    else {
-	hashwidth = 0;
-	if (v == NULL)
-	    return;
-	for (pv = v->vec; pv && *pv; pv++, hashwidth++)
-	    continue;
-	if (hashwidth <= widthof(unsigned char))
-	    hashwidth = sizeof(unsigned char);
-	else if (hashwidth <= widthof(unsigned short))
-	    hashwidth = sizeof(unsigned short);
-	else if (hashwidth <= widthof(unsigned int))
-	    hashwidth = sizeof(unsigned int);
-	else
-	    hashwidth = sizeof(unsigned long);
-    }
+    hashunwatch();
+    if (v == NULL)
+	return;
 
-    if (uhashlength)
-	hashlength = uhashlength;
-    else
-        hashlength = hashwidth * (8*64);/* "average" files per dir in path */
+    for (hashlength = 16, hashshift = 28;
+	 hashlength < (uhashlength ? uhashlength : 1024) &&
+	 hashlength < (1U << 24); hashlength <<= 1, hashshift--)
+	continue;
 
     xfree(xhash);
-    xhash = xcalloc(hashlength * hashwidth, 1);
+    xhash = xcalloc(hashlength, sizeof(*xhash));
+    hashused = 0;
+    hashnameslen = 1;		/* Offset 0 marks a free slot */
+    hashlookups = hashlookprobes = 0;
+# ifndef WINNT_NATIVE
+    execlookups = execstats = 0;
+# endif /* !WINNT_NATIVE */
+# ifdef PATHWATCH
+    hashnamesfree = 0;
+    if (adrof(STRpathwatch)) {
+	int fd;
+
+	if ((fd = inotify_init()) != -1) {
+	    (void) fcntl(fd, F_SETFL, O_NONBLOCK);
+	    (void) close_on_exec(dmove(fd, FSHWATCH), 1);
+	    hashnwd = blklen(v->vec);
+	    hashwd = xmalloc(hashnwd * sizeof(*hashwd));
+	    hashwatchpid = getpid();
+	    havwatch = 1;
+	}
+    }
+# endif /* PATHWATCH */
 #endif /* FASTHASH */
 
     (void) getusername(NULL);	/* flush the tilde cashe */
@@ -698,12 +958,59 @@ dohash(Char **vv, struct command *c)
     havhash = 1;
     if (v == NULL)
 	return;
+#ifdef PATHWATCH
+    /*
+     * Watch first, before any directory is read here or by the threads,
+     * so that no change made while we read is lost
+     */
+    if (havwatch)
+	for (pv = v->vec; pv && *pv; pv++)
+	    hashwd[pv - v->vec] = ABSOLUTEP(pv[0]) ? inotify_add_watch(FSHWATCH,
+		short2str(*pv), HASHWATCHMASK) : -1;
+#endif /* PATHWATCH */
+#ifdef HASHSNAP
+    hashsnapdirs = hashreaddirs = 0;
+    if ((snapfile = varval(STRhashfile)) != STRNULL) {
+	snapfile = Strsave(snapfile);
+	cleanup_push(snapfile, xfree);
+	hashsnapopen(&snap, short2str(snapfile));
+	cleanup_push(&snap, hashsnap_cleanup);
+    }
+#endif /* HASHSNAP */
+#ifdef HASHTHREADS
+    hashscanstart(v->vec, snapfile != STRNULL ? &snap : NULL);
+    cleanup_push(&hashscans, hashscan_cleanup);
+    (void) gettimeofday(&t0, NULL);
+#endif /* HASHTHREADS */
     for (pv = v->vec; pv && *pv; pv++, i++) {
 	if (!ABSOLUTEP(pv[0]))
 	    continue;
+#ifdef HASHSNAP
+	if (snapfile != STRNULL) {
+	    if (stat(short2str(*pv), &stb) == -1 || !S_ISDIR(stb.st_mode))
+		continue;
+	    if (hashsnapuse(&snap, short2str(*pv), i, &stb)) {
+		hashsnapdirs++;
+		continue;
+	    }
+	    snapdir = hashsnapbegin(&snap, short2str(*pv), &stb);
+	}
+#endif /* HASHSNAP */
+#ifdef HASHTHREADS
+	if (hashscans != NULL && hashscans[i].hs_done) {
+	    hashscanmerge(&hashscans[i], i,
+			  snapfile != STRNULL ? &snap : NULL);
+	    goto merged;
+	}
+#endif /* HASHTHREADS */
 	dirp = opendir(short2str(*pv));
-	if (dirp == NULL)
+	if (dirp == NULL) {
+#ifdef HASHSNAP
+	    if (snapfile != STRNULL)
+		snap.new.len = snapdir;	/* Drop the record */
+#endif /* HASHSNAP */
 	    continue;
+	}
 	cleanup_push(dirp, opendir_cleanup);
 #ifdef COMMENT			/* this isn't needed.  opendir won't open
 				 * non-dirs */
@@ -725,43 +1032,36 @@ dohash(Char **vv, struct command *c)
 #ifdef WINNT_NATIVE
 	    nt_check_name_and_hash(is_windir, dp->d_name, i);
 #else /* !WINNT_NATIVE*/
-#if defined(_UWIN) || defined(__CYGWIN__)
-	    /* Turn foo.{exe,com,bat} into foo since UWIN's readdir returns
-	     * the file with the .exe, .com, .bat extension
-	     *
-	     * Same for Cygwin, but only for .exe and .com extension.
-	     */
-	    {
-		ssize_t	ext = strlen(dp->d_name) - 4;
-		if ((ext > 0) && (strcasecmp(&dp->d_name[ext], ".exe") == 0 ||
-#ifndef __CYGWIN__
-				  strcasecmp(&dp->d_name[ext], ".bat") == 0 ||
-#endif
-				  strcasecmp(&dp->d_name[ext], ".com") == 0)) {
-#ifdef __CYGWIN__
-		    /* Also store the variation with extension. */
-		    hashval = hashname(str2short(dp->d_name));
-		    bis(hashval, i);
-#endif /* __CYGWIN__ */
-		    dp->d_name[ext] = '\0';
-		}
-	    }
-#endif /* _UWIN || __CYGWIN__ */
-# ifdef FASTHASH
-	    hashval = hashname(str2short(dp->d_name));
-	    bis(hashval, i);
-	    if (hashdebug & 1)
-	        xprintf(CGETS(13, 1, "hash=%-4d dir=%-2d prog=%s\n"),
-		        hashname(str2short(dp->d_name)), i, dp->d_name);
-# else /* OLD HASH */
-	    hashval = hash(hashname(str2short(dp->d_name)), i);
-	    bis(xhash, hashval);
-# endif /* FASTHASH */
+# ifdef HASHSNAP
+	    if (snapfile != STRNULL)
+		hashsnapname(&snap, dp->d_name, dp->d_ino, dirmode(dp));
+# endif /* HASHSNAP */
+	    hashdirent(dp->d_name, i, dp->d_ino, dirmode(dp));
 	    /* tw_add_comm_name (dp->d_name); */
 #endif /* WINNT_NATIVE */
 	}
 	cleanup_until(dirp);
+#ifdef HASHTHREADS
+merged:
+#endif /* HASHTHREADS */
+#ifdef HASHSNAP
+	hashreaddirs++;
+	if (snapfile != STRNULL)
+	    hashsnapend(&snap, snapdir);
+#endif /* HASHSNAP */
     }
+#ifdef HASHTHREADS
+    if (hashscanthreads)
+	hashmergeusec = hashusec(&t0);
+    cleanup_until(&hashscans);
+#endif /* HASHTHREADS */
+#ifdef HASHSNAP
+    if (snapfile != STRNULL) {
+	if (hashreaddirs != 0 || snap.map == NULL)
+	    hashsnapwrite(&snap, short2str(snapfile));
+	cleanup_until(snapfile);
+    }
+#endif /* HASHSNAP */
 }
 
 /*ARGSUSED*/
@@ -771,9 +1071,11 @@ dounhash(Char **v, struct command *c)
     USE(c);
     USE(v);
     havhash = 0;
+    hashunwatch();
 #ifdef FASTHASH
     xfree(xhash);
     xhash = NULL;
+    hashlength = hashused = 0;
 #endif /* FASTHASH */
 }
 
@@ -784,9 +1086,53 @@ hashstat(Char **v, struct command *c)
     USE(c);
     USE(v);
 #ifdef FASTHASH 
-   if (havhash && hashlength && hashwidth)
-      xprintf(CGETS(13, 2, "%d hash buckets of %d bits each\n"),
-	      hashlength, hashwidth*8);
+   if (havhash && hashlength) {
+      unsigned long collisions = 0, probes = 0;
+      unsigned int s, d, maxprobe = 0;
+
+      /* A probe length is the distance of an entry from its home slot */
+      for (s = 0; s < hashlength; s++) {
+	  if (xhash[s].he_name == 0)
+	      continue;
+	  d = (s - hashslot(xhash[s].he_hash)) & (hashlength - 1);
+	  if (d != 0)
+	      collisions++;
+	  probes += d + 1;
+	  if (d + 1 > maxprobe)
+	      maxprobe = d + 1;
+      }
+      xprintf(CGETS(13, 11,
+		    "%u commands in %u hash slots, load factor %u%%\n"),
+	      hashused, hashlength,
+	      (unsigned int) (100UL * hashused / hashlength));
+      if (hashused)
+	  xprintf(CGETS(13, 12,
+			"%lu collisions, average probe %lu.%02lu, longest %u\n"),
+		  collisions, probes / hashused, probes * 100 / hashused % 100,
+		  maxprobe);
+      if (hashlookups)
+	  xprintf(CGETS(13, 13, "%lu lookups, average probe %lu.%02lu\n"),
+		  hashlookups, hashlookprobes / hashlookups,
+		  hashlookprobes * 100 / hashlookups % 100);
+# ifndef WINNT_NATIVE
+      if (execlookups)
+	  xprintf(CGETS(13, 16, "%lu file checks, %lu stats\n"),
+		  execlookups, execstats);
+# endif /* !WINNT_NATIVE */
+# ifdef HASHSNAP
+      if (adrof(STRhashfile))
+	  xprintf(CGETS(13, 14, "%d directories from %S, %d read\n"),
+		  hashsnapdirs, varval(STRhashfile), hashreaddirs);
+# endif /* HASHSNAP */
+# ifdef HASHTHREADS
+      if (hashscanthreads)
+	  xprintf(CGETS(13, 15, "%d directories read by %d threads in "
+			"%lu.%03lu ms, merged in %lu.%03lu ms\n"),
+		  hashscandirs, hashscanthreads, hashscanusec / 1000,
+		  hashscanusec % 1000, hashmergeusec / 1000,
+		  hashmergeusec % 1000);
+# endif /* HASHTHREADS */
+   }
    if (hashdebug)
       xprintf(CGETS(13, 3, "debug mask = 0x%08x\n"), hashdebug);
 #endif /* FASTHASH */
@@ -804,13 +1150,781 @@ hashstat(Char **v, struct command *c)
 int
 hashname(Char *cp)
 {
-    unsigned long h;
+    unsigned int h;
 
     for (h = 0; *cp; cp++)
 	h = hash(h, *cp);
     return ((int) h);
 }
 
+#ifdef FASTHASH
+static void
+hashresize(unsigned int length)
+{
+    struct hashent *oxhash = xhash;
+    unsigned int olength = hashlength, i, s;
+
+    xhash = xcalloc(length, sizeof(*xhash));
+    hashlength = length;
+    hashshift--;
+    for (i = 0; i < olength; i++) {
+	if (oxhash[i].he_name == 0)
+	    continue;
+	for (s = hashslot(oxhash[i].he_hash); xhash[s].he_name != 0;
+	     s = hashnext(s))
+	    continue;
+	xhash[s] = oxhash[i];
+    }
+    xfree(oxhash);
+}
+
+/*
+ * Record that name was found in the i'th component of path.
+ */
+static void
+hashenter(Char *name, int i, ino_t ino, mode_t mode)
+{
+    struct hashent *he;
+    unsigned int h, s;
+    size_t len;
+
+    if (2 * (hashused + 1) > hashlength)
+	hashresize(2 * hashlength);
+    h = (unsigned int) hashname(name);
+    for (s = hashslot(h); (he = &xhash[s])->he_name != 0; s = hashnext(s))
+	if (he->he_hash == h && he->he_dir == i &&
+	    Strcmp(hashentname(he), name) == 0)
+	    return;
+
+    len = Strlen(name) + 1;
+    if (hashnameslen + len > hashnamessize) {
+	hashnamessize = 2 * (hashnameslen + len) + 8 * hashlength;
+	hashnames = xrealloc(hashnames, hashnamessize * sizeof(*hashnames));
+    }
+    (void) memcpy(&hashnames[hashnameslen], name, len * sizeof(*hashnames));
+    he->he_name = hashnameslen;
+    he->he_hash = h;
+    he->he_dir = i;
+    he->he_ino = ino;
+    he->he_mode = mode;
+    hashnameslen += len;
+    hashused++;
+}
+
+/*
+ * Return the index of the first component of path at or after from
+ * that name was found in, or -1 if there is none.  If hep is not NULL,
+ * the matching entry is stored there.
+ */
+static int
+hashfind(Char *name, int hashval, int from, struct hashent **hep)
+{
+    struct hashent *he, *found = NULL;
+    unsigned int h = (unsigned int) hashval, s;
+
+    if (xhash != NULL) {
+	hashlookups++;
+	for (s = hashslot(h); (he = &xhash[s])->he_name != 0;
+	     s = hashnext(s)) {
+	    hashlookprobes++;
+	    if (he->he_hash == h && he->he_dir >= from &&
+		(found == NULL || he->he_dir < found->he_dir) &&
+		Strcmp(hashentname(he), name) == 0)
+		found = he;
+	}
+    }
+    if (hep)
+	*hep = found;
+    return found ? found->he_dir : -1;
+}
+
+# ifdef PATHWATCH
+/*
+ * Empty slot s, moving back the entries after it that would otherwise
+ * no longer be found from their home slot.
+ */
+static void
+hashdelete(unsigned int s)
+{
+    unsigned int j, mask = hashlength - 1;
+
+    hashnamesfree += Strlen(hashentname(&xhash[s])) + 1;
+    hashused--;
+    for (j = hashnext(s); xhash[j].he_name != 0; j = hashnext(j)) {
+	if (((j - hashslot(xhash[j].he_hash)) & mask) >= ((j - s) & mask)) {
+	    xhash[s] = xhash[j];
+	    s = j;
+	}
+    }
+    xhash[s].he_name = 0;
+}
+
+/*
+ * Forget that name was found in the i'th component of path.
+ */
+static void
+hashremove(Char *name, int i)
+{
+    struct hashent *he;
+    unsigned int h, s;
+
+    h = (unsigned int) hashname(name);
+    for (s = hashslot(h); (he = &xhash[s])->he_name != 0; s = hashnext(s))
+	if (he->he_hash == h && he->he_dir == i &&
+	    Strcmp(hashentname(he), name) == 0) {
+	    hashdelete(s);
+	    return;
+	}
+}
+
+/*
+ * Forget every name found in the i'th component of path.
+ */
+static void
+hashremovedir(int i)
+{
+    unsigned int s;
+
+    for (s = 0; s < hashlength; s++)
+	while (xhash[s].he_name != 0 && xhash[s].he_dir == i)
+	    hashdelete(s);
+}
+
+/*
+ * Squeeze the names of removed entries out of hashnames.
+ */
+static void
+hashcompact(void)
+{
+    Char *onames = hashnames;
+    size_t len;
+    unsigned int s;
+
+    hashnames = xmalloc(hashnamessize * sizeof(*hashnames));
+    hashnameslen = 1;
+    for (s = 0; s < hashlength; s++) {
+	if (xhash[s].he_name == 0)
+	    continue;
+	len = Strlen(&onames[xhash[s].he_name]) + 1;
+	(void) memcpy(&hashnames[hashnameslen], &onames[xhash[s].he_name],
+		      len * sizeof(*hashnames));
+	xhash[s].he_name = hashnameslen;
+	hashnameslen += len;
+    }
+    hashnamesfree = 0;
+    xfree(onames);
+}
+# endif /* PATHWATCH */
+
+# ifdef HASHSNAP
+/*
+ * Start a new snapshot, and map the old one in file if it is usable.
+ */
+static void
+hashsnapopen(struct hashsnapstate *snap, const char *file)
+{
+    struct hashsnap hs;
+    struct stat st;
+    int fd;
+
+    snap->map = NULL;
+    snap->size = 0;
+    snap->mapped = 0;
+    snap->new = strbuf_init;
+    snap->ndirs = 0;
+    snap->nnames = 0;
+    (void) memset(&hs, 0, sizeof(hs));	/* Filled in by hashsnapwrite() */
+    strbuf_appendn(&snap->new, (const char *) &hs, sizeof(hs));
+
+    if ((fd = xopen(file, O_RDONLY|O_LARGEFILE)) == -1)
+	return;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+	st.st_size < (off_t) sizeof(hs) || st.st_size > INT_MAX) {
+	xclose(fd);
+	return;
+    }
+    snap->size = st.st_size;
+#ifdef HAVE_MMAP
+    snap->map = mmap(NULL, snap->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (snap->map == MAP_FAILED)
+	snap->map = NULL;
+    else
+	snap->mapped = 1;
+#endif /* HAVE_MMAP */
+    if (snap->map == NULL) {
+	snap->map = xmalloc(snap->size);
+	if (xread(fd, snap->map, snap->size) != (ssize_t) snap->size) {
+	    xfree(snap->map);
+	    snap->map = NULL;
+	}
+    }
+    xclose(fd);
+    if (snap->map == NULL)
+	return;
+
+    (void) memcpy(&hs, snap->map, sizeof(hs));
+    if (memcmp(hs.hs_magic, HASHSNAPMAGIC, sizeof(hs.hs_magic)) != 0 ||
+	hs.hs_version != HASHSNAPVERSION || hs.hs_size != snap->size) {
+#ifdef HAVE_MMAP
+	if (snap->mapped)
+	    (void) munmap(snap->map, snap->size);
+	else
+#endif /* HAVE_MMAP */
+	    xfree(snap->map);
+	snap->map = NULL;
+    }
+}
+
+static void
+hashsnap_cleanup(void *xsnap)
+{
+    struct hashsnapstate *snap;
+
+    snap = xsnap;
+    if (snap->map != NULL) {
+#ifdef HAVE_MMAP
+	if (snap->mapped)
+	    (void) munmap(snap->map, snap->size);
+	else
+#endif /* HAVE_MMAP */
+	    xfree(snap->map);
+    }
+    xfree(snap->new.s);
+}
+
+/*
+ * Return the record after rec (or the first one if rec is NULL) in the
+ * snapshot at base, copying its header to hd; NULL if there is no more
+ * or the record is damaged.
+ */
+static const char *
+hashsnapnext(const char *base, size_t size, const char *rec,
+	     struct hashsnapdir *hd)
+{
+    size_t left;
+
+    if (rec == NULL)
+	rec = base + sizeof(struct hashsnap);
+    else
+	rec += hd->hd_size;
+    left = size - (rec - base);
+    if (left < sizeof(*hd))
+	return NULL;
+    (void) memcpy(hd, rec, sizeof(*hd));
+    if (hd->hd_size > left || hd->hd_size % 8 != 0 || hd->hd_pathlen == 0 ||
+	hd->hd_size < sizeof(*hd) + hd->hd_pathlen ||
+	rec[sizeof(*hd) + hd->hd_pathlen - 1] != '\0')
+	return NULL;
+    return rec;
+}
+
+/*
+ * Return the record of directory dir in the snapshot at base, or NULL.
+ */
+static const char *
+hashsnapfind(const char *base, size_t size, const char *dir,
+	     struct hashsnapdir *hd)
+{
+    const char *rec;
+
+    for (rec = NULL; (rec = hashsnapnext(base, size, rec, hd)) != NULL;)
+	if (strcmp(rec + sizeof(*hd), dir) == 0)
+	    break;
+    return rec;
+}
+
+/*
+ * Enter the names of record rec as found in the i'th component of path.
+ */
+static void
+hashsnapload(const char *rec, const struct hashsnapdir *hd, int i)
+{
+    struct hashsnapname hn;
+    const char *p, *end;
+    char name[MAXPATHLEN];
+    uint32_t n;
+
+    p = rec + sizeof(*hd) + hd->hd_pathlen;
+    end = rec + hd->hd_size;
+    for (n = 0; n < hd->hd_nnames; n++) {
+	if ((size_t) (end - p) < sizeof(hn))
+	    break;
+	(void) memcpy(&hn, p, sizeof(hn));
+	p += sizeof(hn);
+	if (hn.hn_len >= sizeof(name) || hn.hn_len > (size_t) (end - p))
+	    break;
+	(void) memcpy(name, p, hn.hn_len);
+	name[hn.hn_len] = '\0';
+	p += hn.hn_len;
+	hashdirent(name, i, (ino_t) hn.hn_ino, (mode_t) hn.hn_mode);
+    }
+}
+
+/*
+ * Enter the names of directory dir, whose status is st, from the new or
+ * the old snapshot if either has an up to date record of it.  Return
+ * whether we did.
+ */
+static int
+hashsnapuse(struct hashsnapstate *snap, const char *dir, int i,
+	    const struct stat *st)
+{
+    struct hashsnapdir hd;
+    const char *rec;
+
+    /* A directory listed twice in path was seen a moment ago */
+    rec = hashsnapfind(snap->new.s, snap->new.len, dir, &hd);
+    if (rec != NULL && hd.hd_dev == (uint64_t) st->st_dev &&
+	hd.hd_ino == (uint64_t) st->st_ino &&
+	hd.hd_mtime == (int64_t) st->st_mtime) {
+	hashsnapload(rec, &hd, i);
+	return 1;
+    }
+    if (rec != NULL || (rec = hashsnapfresh(snap, dir, st, &hd)) == NULL)
+	return 0;
+    hashsnapload(rec, &hd, i);
+    strbuf_appendn(&snap->new, rec, hd.hd_size);
+    snap->ndirs++;
+    return 1;
+}
+
+/*
+ * Return the record of directory dir, whose status is st, in the old
+ * snapshot, if it is still good.
+ */
+static const char *
+hashsnapfresh(struct hashsnapstate *snap, const char *dir,
+	      const struct stat *st, struct hashsnapdir *hd)
+{
+    const char *rec;
+
+    if (snap->map == NULL)
+	return NULL;
+    rec = hashsnapfind(snap->map, snap->size, dir, hd);
+    if (rec == NULL || hd->hd_dev != (uint64_t) st->st_dev ||
+	hd->hd_ino != (uint64_t) st->st_ino ||
+	hd->hd_mtime != (int64_t) st->st_mtime ||
+	hd->hd_mtime + HASHSNAPSLACK >= hd->hd_readtime)
+	return NULL;
+    return rec;
+}
+
+/*
+ * Start the record of directory dir, whose status is st, and return
+ * its offset in the new snapshot.
+ */
+static size_t
+hashsnapbegin(struct hashsnapstate *snap, const char *dir,
+	      const struct stat *st)
+{
+    struct hashsnapdir hd;
+    size_t off = snap->new.len;
+
+    (void) memset(&hd, 0, sizeof(hd));
+    hd.hd_pathlen = strlen(dir) + 1;
+    hd.hd_dev = st->st_dev;
+    hd.hd_ino = st->st_ino;
+    hd.hd_mtime = st->st_mtime;
+    hd.hd_readtime = time(NULL);
+    strbuf_appendn(&snap->new, (const char *) &hd, sizeof(hd));
+    strbuf_appendn(&snap->new, dir, hd.hd_pathlen);
+    snap->nnames = 0;
+    return off;
+}
+
+static void
+hashsnapname(struct hashsnapstate *snap, const char *name, ino_t ino,
+	     mode_t mode)
+{
+    struct hashsnapname hn;
+
+    hn.hn_ino = ino;
+    hn.hn_mode = mode;
+    hn.hn_len = strlen(name);
+    strbuf_appendn(&snap->new, (const char *) &hn, sizeof(hn));
+    strbuf_appendn(&snap->new, name, hn.hn_len);
+    snap->nnames++;
+}
+
+/*
+ * Finish the record that starts at offset off of the new snapshot.
+ */
+static void
+hashsnapend(struct hashsnapstate *snap, size_t off)
+{
+    struct hashsnapdir hd;
+
+    while (snap->new.len % 8 != 0)
+	strbuf_append1(&snap->new, '\0');
+    (void) memcpy(&hd, snap->new.s + off, sizeof(hd));
+    hd.hd_size = snap->new.len - off;
+    hd.hd_nnames = snap->nnames;
+    (void) memcpy(snap->new.s + off, &hd, sizeof(hd));
+    snap->ndirs++;
+}
+
+/*
+ * Add the records of the old snapshot for the directories not in path,
+ * up to HASHSNAPMAXDIRS of them, and replace file with the result.
+ */
+static void
+hashsnapwrite(struct hashsnapstate *snap, const char *file)
+{
+    struct hashsnapdir hd, nhd;
+    struct hashsnap hs;
+    const char *rec;
+    char path[MAXPATHLEN];
+    Char *rs;
+    int fd;
+
+    for (rec = NULL; snap->map != NULL && snap->ndirs < HASHSNAPMAXDIRS &&
+	 (rec = hashsnapnext(snap->map, snap->size, rec, &hd)) != NULL;) {
+	if (hashsnapfind(snap->new.s, snap->new.len, rec + sizeof(hd),
+			 &nhd) != NULL)
+	    continue;
+	strbuf_appendn(&snap->new, rec, hd.hd_size);
+	snap->ndirs++;
+    }
+
+    (void) memset(&hs, 0, sizeof(hs));
+    (void) memcpy(hs.hs_magic, HASHSNAPMAGIC, sizeof(hs.hs_magic));
+    hs.hs_version = HASHSNAPVERSION;
+    hs.hs_ndirs = snap->ndirs;
+    hs.hs_size = snap->new.len;
+    (void) memcpy(snap->new.s, &hs, sizeof(hs));
+
+    rs = randsuf();
+    xsnprintf(path, sizeof(path), "%s.%S", file, rs);
+    xfree(rs);
+    if ((fd = xcreat(path, 0600)) == -1)
+	return;
+    if (xwrite(fd, snap->new.s, snap->new.len) != (ssize_t) snap->new.len) {
+	xclose(fd);
+	(void) unlink(path);
+	return;
+    }
+    xclose(fd);
+    if (rename(path, file) == -1)
+	(void) unlink(path);
+}
+# endif /* HASHSNAP */
+
+# ifdef HASHTHREADS
+/*
+ * A worker: read the directories not yet taken by another one.
+ */
+static void *
+hashscanner(void *arg)
+{
+    struct hashscan *hs;
+    size_t n;
+
+    USE(arg);
+    for (;;) {
+	(void) pthread_mutex_lock(&hashscanlock);
+	n = hashnextscan++;
+	(void) pthread_mutex_unlock(&hashscanlock);
+	if (n >= hashnscans)
+	    return NULL;
+	hs = &hashscans[n];
+	if (hs->hs_dir != NULL)
+	    hs->hs_done = hashscandir(hs);
+    }
+}
+
+/*
+ * Collect the entries of a directory in a worker, and tell whether we
+ * got all of them.  No shell function may be called from here.
+ */
+static int
+hashscandir(struct hashscan *hs)
+{
+    DIR *dirp;
+    struct dirent *dp;
+    struct hashscanent *ent;
+    size_t len;
+    void *p;
+
+    if ((dirp = opendir(hs->hs_dir)) == NULL)
+	return 0;
+    while ((dp = readdir(dirp)) != NULL) {
+	if (dp->d_ino == 0)
+	    continue;
+	if (dp->d_name[0] == '.' &&
+	    (dp->d_name[1] == '\0' ||
+	     (dp->d_name[1] == '.' && dp->d_name[2] == '\0')))
+	    continue;
+	len = strlen(dp->d_name) + 1;
+	if (hs->hs_nameslen + len > hs->hs_namessize) {
+	    if ((p = realloc(hs->hs_names,
+			     (hs->hs_nameslen + len) * 2)) == NULL)
+		break;
+	    hs->hs_names = p;
+	    hs->hs_namessize = (hs->hs_nameslen + len) * 2;
+	}
+	if (hs->hs_nents == hs->hs_entssize) {
+	    if ((p = realloc(hs->hs_ents, (hs->hs_entssize * 2 + 64) *
+			     sizeof(*hs->hs_ents))) == NULL)
+		break;
+	    hs->hs_ents = p;
+	    hs->hs_entssize = hs->hs_entssize * 2 + 64;
+	}
+	(void) memcpy(&hs->hs_names[hs->hs_nameslen], dp->d_name, len);
+	ent = &hs->hs_ents[hs->hs_nents++];
+	ent->hse_name = hs->hs_nameslen;
+	ent->hse_ino = dp->d_ino;
+	ent->hse_mode = dirmode(dp);
+	hs->hs_nameslen += len;
+    }
+    (void) closedir(dirp);
+    return dp == NULL;
+}
+
+/*
+ * Have hashthreads workers read the absolute components of path that
+ * dohash() is going to read, and wait for them to finish.  Nothing is
+ * done unless there are at least two such directories.
+ */
+static void
+hashscanstart(Char **pv, struct hashsnapstate *snap)
+{
+    struct hashsnapdir hd;
+    struct stat st;
+    struct timeval t0;
+    sigset_t set, oset;
+    pthread_t *tid;
+    Char *val;
+    char *dir;
+    size_t i;
+    int nthreads, t;
+
+    hashscanthreads = hashscandirs = 0;
+    hashscanusec = hashmergeusec = 0;
+    if (adrof(STRhashthreads) == NULL)
+	return;
+    val = varval(STRhashthreads);
+    nthreads = *val ? atoi(short2str(val)) : HASHTHREADSDEF;
+    if (nthreads < 2)
+	return;
+
+    hashnscans = blklen(pv);
+    hashnextscan = 0;
+    hashscans = xcalloc(hashnscans, sizeof(*hashscans));
+    for (i = 0; i < hashnscans; i++) {
+	if (!ABSOLUTEP(pv[i]))
+	    continue;
+	dir = strsave(short2str(pv[i]));
+	/* Leave what the snapshot has to dohash() */
+	if (snap != NULL && (stat(dir, &st) == -1 || !S_ISDIR(st.st_mode) ||
+			     hashsnapfresh(snap, dir, &st, &hd) != NULL)) {
+	    xfree(dir);
+	    continue;
+	}
+	hashscans[i].hs_dir = dir;
+	hashscandirs++;
+    }
+    if (hashscandirs < 2) {
+	hashscandirs = 0;
+	return;
+    }
+    if (nthreads > hashscandirs)
+	nthreads = hashscandirs;
+    if (nthreads > HASHTHREADSMAX)
+	nthreads = HASHTHREADSMAX;
+
+    tid = xmalloc(nthreads * sizeof(*tid));
+    (void) gettimeofday(&t0, NULL);
+    /* Signals are for the shell */
+    sigfillset(&set);
+    (void) pthread_sigmask(SIG_SETMASK, &set, &oset);
+    for (t = 0; t < nthreads; t++)
+	if (pthread_create(&tid[t], NULL, hashscanner, NULL) != 0)
+	    break;
+    (void) pthread_sigmask(SIG_SETMASK, &oset, NULL);
+    hashscanthreads = t;
+    while (t-- > 0)
+	(void) pthread_join(tid[t], NULL);
+    xfree(tid);
+    hashscanusec = hashusec(&t0);
+}
+
+static void
+hashscan_cleanup(void *xhs)
+{
+    size_t i;
+
+    USE(xhs);
+    if (hashscans == NULL)
+	return;
+    for (i = 0; i < hashnscans; i++) {
+	xfree(hashscans[i].hs_dir);
+	free(hashscans[i].hs_names);
+	free(hashscans[i].hs_ents);
+    }
+    xfree(hashscans);
+    hashscans = NULL;
+    hashnscans = 0;
+}
+
+/*
+ * Enter what a worker read from the i'th component of path.
+ */
+static void
+hashscanmerge(struct hashscan *hs, int i, struct hashsnapstate *snap)
+{
+    struct hashscanent *ent;
+    size_t n;
+
+    for (n = 0; n < hs->hs_nents; n++) {
+	ent = &hs->hs_ents[n];
+	if (snap != NULL)
+	    hashsnapname(snap, &hs->hs_names[ent->hse_name], ent->hse_ino,
+			 ent->hse_mode);
+	hashdirent(&hs->hs_names[ent->hse_name], i, ent->hse_ino,
+		   ent->hse_mode);
+    }
+}
+
+/*
+ * Microseconds since t0
+ */
+static unsigned long
+hashusec(const struct timeval *t0)
+{
+    struct timeval t1;
+
+    (void) gettimeofday(&t1, NULL);
+    return (unsigned long) (t1.tv_sec - t0->tv_sec) * 1000000UL +
+	t1.tv_usec - t0->tv_usec;
+}
+# endif /* HASHTHREADS */
+#endif /* FASTHASH */
+
+/*
+ * Bring the hash table up to date with the changes in the watched path
+ * directories.  This costs a single read when nothing has changed.
+ */
+void
+hashwatch(void)
+{
+#ifdef PATHWATCH
+    long buf[4096 / sizeof(long)];	/* aligned for struct inotify_event */
+    struct inotify_event *ev;
+    struct varent *v;
+    char *p;
+    ssize_t n;
+    int i, overflow = 0;
+
+    if (!havwatch || !havhash || getpid() != hashwatchpid)
+	return;
+    /* Any change of path rebuilds the watches, but be careful */
+    v = adrof(STRpath);
+    if (v == NULL || v->vec == NULL || blklen(v->vec) != hashnwd)
+	return;
+    while ((n = xread(FSHWATCH, buf, sizeof(buf))) > 0) {
+	execflush();
+	for (p = (char *) buf; p < (char *) buf + n;
+	     p += sizeof(*ev) + ev->len) {
+	    ev = (struct inotify_event *) (void *) p;
+	    if (ev->mask & IN_Q_OVERFLOW)
+		overflow = 1;
+	    for (i = 0; i < hashnwd && !overflow; i++) {
+		Char *name;
+
+		if (hashwd[i] != ev->wd)
+		    continue;
+		if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+		    hashremovedir(i);
+		    hashwd[i] = -1;
+		    tw_cmd_free();
+		    continue;
+		}
+		if (ev->len == 0)
+		    continue;
+		name = Strsave(str2short(ev->name));
+		cleanup_push(name, xfree);
+		if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+		    hashenter(name, i, 0, 0);
+		    tw_cmd_change(v->vec[i], name, 1);
+		}
+		else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+		    hashremove(name, i);
+		    if (hashfind(name, hashname(name), 0, NULL) == -1)
+			tw_cmd_change(v->vec[i], name, 0);
+		}
+		cleanup_until(name);
+	    }
+	}
+    }
+    if (overflow)
+	dohash(NULL, NULL);
+    else if (hashnamesfree > hashnameslen / 2)
+	hashcompact();
+#endif /* PATHWATCH */
+}
+
+/*
+ * Stop watching the path directories.
+ */
+void
+hashunwatch(void)
+{
+#ifdef PATHWATCH
+    if (!havwatch)
+	return;
+    havwatch = 0;
+    xclose(FSHWATCH);
+    xfree(hashwd);
+    hashwd = NULL;
+    hashnwd = 0;
+#endif /* PATHWATCH */
+}
+
+/*
+ * Return the file doexec() would try first for the command name, as far
+ * as the hash table alone can tell.  NULL means that a real search of the
+ * path is needed: the name is not hashed, or a relative path component
+ * comes before the directory that has it.
+ */
+char *
+hashpath(Char *name)
+{
+#ifdef FASTHASH
+    struct hashent *he;
+    struct varent *v;
+    Char *dp, *sav;
+    char *path;
+    int i, hashdir;
+#endif /* FASTHASH */
+
+    if (Strchr(name, '/') != NULL) {
+	if (adrof(STRpath) == NULL && name[0] != '/' && name[0] != '.')
+	    return NULL;
+	return strsave(short2str(name));
+    }
+#ifdef FASTHASH
+    v = adrof(STRpath);
+    if (!havhash || v == NULL || v->vec == NULL)
+	return NULL;
+    hashdir = hashfind(name, hashname(name), 0, &he);
+    if (hashdir < 0 || S_ISDIR(he->he_mode))
+	return NULL;
+    for (i = 0; i < hashdir; i++)
+	if (v->vec[i] == NULL || !ABSOLUTEP(v->vec[i]))
+	    return NULL;
+    if (v->vec[hashdir] == NULL)
+	return NULL;
+    sav = Strspl(STRslash, name);
+    dp = Strspl(v->vec[hashdir], sav);
+    xfree(sav);
+    path = strsave(short2str(dp));
+    xfree(dp);
+    return path;
+#else /* OLDHASH */
+    return NULL;
+#endif /* FASTHASH */
+}
+
 static int
 iscommand(Char *name)
 {
@@ -819,7 +1933,12 @@ iscommand(Char *name)
     struct varent *v;
     int slash = any(short2str(name), '/');
     int hashval, rehashed, i;
+#ifdef FASTHASH
+    struct hashent *he;
+    int hashdir, isdir;
+#endif /* FASTHASH */
 
+    hashwatch();
     v = adrof(STRpath);
     if (v == NULL || v->vec == NULL || v->vec[0] == NULL || slash)
 	opv = justabs;
@@ -832,10 +1951,18 @@ iscommand(Char *name)
 retry:
     pv = opv;
     i = 0;
+#ifdef FASTHASH
+    hashdir = havhash ? hashfind(name, hashval, 0, &he) : -1;
+#endif /* FASTHASH */
     do {
 	if (!slash && ABSOLUTEP(pv[0]) && havhash) {
 #ifdef FASTHASH
-	    if (!bit(hashval, i))
+	    if (i != hashdir)
+		goto cont;
+	    /* readdir() already told us that a directory won't do */
+	    isdir = S_ISDIR(he->he_mode);
+	    hashdir = hashfind(name, hashval, i + 1, &he);
+	    if (isdir)
 		goto cont;
 #else /* OLDHASH */
 	    int hashval1 = hash(hashval, i);
@@ -878,6 +2005,17 @@ cont:
  * Thanks again!!
  */
 
+/*
+ * Forget the answers of executable().
+ */
+void
+execflush(void)
+{
+#ifndef WINNT_NATIVE
+    execgen++;
+#endif /* !WINNT_NATIVE */
+}
+
 #ifndef WINNT_NATIVE
 /*
  * executable() examines the pathname obtained by concatenating dir and name
@@ -889,7 +2027,10 @@ int
 executable(const Char *dir, const Char *name, int dir_ok)
 {
     struct stat stbuf;
+    struct execcache *ec;
+    const char *p;
     char   *strname;
+    unsigned int h;
 
     if (dir && *dir) {
 	Char *path;
@@ -901,13 +2042,36 @@ executable(const Char *dir, const Char *name, int dir_ok)
     else
 	strname = short2str(name);
 
-    return (stat(strname, &stbuf) != -1 &&
-	    ((dir_ok && S_ISDIR(stbuf.st_mode)) ||
-	     (S_ISREG(stbuf.st_mode) &&
+    /*
+     * Only names under an absolute directory are flushed when they change:
+     * those under ., or given in full, are looked at every time
+     */
+    if (dir == NULL || !ABSOLUTEP(dir)) {
+	if (stat(strname, &stbuf) == -1)
+	    return 0;
+	return (dir_ok && S_ISDIR(stbuf.st_mode)) ||
+	    (S_ISREG(stbuf.st_mode) &&
+	     (stbuf.st_mode & (S_IXOTH | S_IXGRP | S_IXUSR)) &&
+	     access(strname, X_OK) == 0);
+    }
+
+    for (h = 0, p = strname; *p; p++)
+	h = h * 31 + (unsigned char) *p;
+    ec = &execcache[h & (EXECCACHESIZE - 1)];
+    execlookups++;
+    if (ec->ec_path == NULL || ec->ec_gen != execgen ||
+	strcmp(ec->ec_path, strname) != 0) {
+	xfree(ec->ec_path);
+	ec->ec_path = strsave(strname);
+	ec->ec_gen = execgen;
+	ec->ec_mode = stat(strname, &stbuf) != -1 ? stbuf.st_mode : 0;
+	ec->ec_xok = S_ISREG(ec->ec_mode) &&
     /* save time by not calling access() in the hopeless case */
-	      (stbuf.st_mode & (S_IXOTH | S_IXGRP | S_IXUSR)) &&
-	      access(strname, X_OK) == 0
-	)));
+	    (ec->ec_mode & (S_IXOTH | S_IXGRP | S_IXUSR)) &&
+	    access(strname, X_OK) == 0;
+	execstats++;
+    }
+    return (dir_ok && S_ISDIR(ec->ec_mode)) || ec->ec_xok;
 }
 #endif /*!WINNT_NATIVE*/
 
@@ -1089,6 +2253,9 @@ find_cmd(Char *cmd, int prt)
     Char **pv;
     Char *sv;
     int hashval, rehashed, i, ex, rval = 0;
+#ifdef FASTHASH
+    int hashdir;
+#endif /* FASTHASH */
 
     if (prt && any(short2str(cmd), '/')) {
 	xprintf("%s", CGETS(13, 7, "where: / in command makes no sense\n"));
@@ -1142,11 +2309,15 @@ find_cmd(Char *cmd, int prt)
 
     rehashed = 0;
 retry:
+#ifdef FASTHASH
+    hashdir = havhash ? hashfind(cmd, hashval, 0, NULL) : -1;
+#endif /* FASTHASH */
     for (pv = var->vec, i = 0; pv && *pv; pv++, i++) {
 	if (havhash && !eq(*pv, STRdot)) {
 #ifdef FASTHASH
-	    if (!bit(hashval, i))
+	    if (i != hashdir)
 		continue;
+	    hashdir = hashfind(cmd, hashval, i + 1, NULL);
 #else /* OLDHASH */
 	    int hashval1 = hash(hashval, i);
 	    if (!bit(xhash, hashval1))
@@ -1188,17 +2359,18 @@ int hashval_extern(cp)
 {
 	return havhash?hashname(cp):0;
 }
-int bit_extern(val,i)
+int bit_extern(cp,val,i)
+	Char *cp;
 	int val;
 	int i;
 {
-	return bit(val,i);
+	return hashfind(cp, val, i, NULL) == i;
 }
-void bis_extern(val,i)
-	int val;
+void bis_extern(cp,i)
+	Char *cp;
 	int i;
 {
-	bis(val,i);
+	hashenter(cp, i, 0, 0);
 }
 #endif /* WINNT_NATIVE */
 
@@ -43,6 +43,16 @@ RCSID("$tcsh$")
 #define TEXP_IGNORE 1	/* in ignore, it means to ignore value, just parse */
 #define TEXP_NOGLOB 2	/* in ignore, it means not to globone */
 
+#ifdef convex
+# define TCSH_STAT	stat64
+# define TCSH_LSTAT	lstat64
+typedef struct cvxstat ftstat_t;
+#else
+# define TCSH_STAT	stat
+# define TCSH_LSTAT	lstat
+typedef struct stat ftstat_t;
+#endif /* convex */
+
 #define	ADDOP	1
 #define	MULOP	2
 #define	EQOP	4
@@ -57,7 +67,65 @@ RCSID("$tcsh$")
 #define EQMATCH 7
 #define NOTEQMATCH 8
 
+/*
+ * Expressions in loops are compiled into a tree once and the tree is
+ * walked on each pass, so that only the words themselves are globbed and
+ * converted again.  How exp0() .. exp6() split a list depends only on
+ * which words are operators, so a tree is kept for each shape of list:
+ * the operator words themselves, with the other words left out.  Each
+ * node mirrors one step of exp0() .. exp6(), in the same order, with the
+ * same errors and the same results for ignored parts, so the two agree.
+ * Lists the compiler does not handle (csh compatible expressions,
+ * {command} and file tests, syntax errors) get a tree of -1 and are left
+ * to exp0().
+ */
+enum enop {
+    EN_OR2, EN_AND2, EN_OR, EN_XOR, EN_AND,	/* numbers from numbers */
+    EN_EQ,			/* == != =~ !~: a number from two strings */
+    EN_GETN,			/* the number of a string */
+    EN_REL, EN_SHIFT, EN_ADD, EN_MUL,	/* numbers as strings */
+    EN_DROP,			/* `op' after the left side of =~ */
+    EN_NOT, EN_COMPL, EN_PAREN,
+    EN_NULL,			/* an operator where a word should be */
+    EN_WORD, EN_GLOB		/* a word, or a word globbed */
+};
+
+struct enode {
+    enum enop en_op;
+    int     en_code;		/* isa() code or operator character */
+    int     en_left;		/* node, or word for EN_WORD and EN_GLOB */
+    int     en_right;
+};
+
+struct eprog {
+    Char  **ep_sig;		/* Operator words of the shape, else NULL */
+    size_t  ep_nwords;
+    unsigned int ep_hval;
+    int     ep_root;		/* -1 if the shape is left to exp0() */
+    int     ep_used;		/* Words the expression takes */
+    struct enode *ep_nodes;
+    int     ep_nnodes;
+    int     ep_pos;		/* While compiling, the next word */
+    int     ep_fail;
+    Char  **ep_words;		/* While walking, the words */
+};
+
+/* A string, or a number that has not been made a string yet */
+struct evalue {
+    Char   *ev_str;
+    tcsh_number_t ev_num;
+};
+
+#define EPROGS	64
+#define ENUMMAX	\
+    ((((tcsh_number_t) 1 << (sizeof(tcsh_number_t) * 8 - 2)) - 1) * 2 + 1)
+static struct eprog *eprogs[EPROGS];
+
 static	int	   sh_access	(const Char *, int);
+static	time_t	 fttimeout	(void);
+static	struct ftcache *ftentry	(const Char *);
+static	ftstat_t  *ftstat	(const Char *, int);
+static	int	   ftaccess	(const Char *, int);
 static	tcsh_number_t  exp1		(Char ***, int);
 static	tcsh_number_t  exp2x	(Char ***, int);
 static	tcsh_number_t  exp2a	(Char ***, int);
@@ -71,6 +139,23 @@ static	Char 	  *exp6		(Char ***, int);
 static	void	   evalav	(Char **);
 static	int	   isa		(Char *, int);
 static	tcsh_number_t  egetn	(const Char *);
+static	int	   eplain	(const Char *);
+static	struct eprog *eprogof	(Char **);
+static	int	   ecomp0	(struct eprog *, int);
+static	int	   ecomp1	(struct eprog *, int);
+static	int	   ecomp2	(struct eprog *, int, int);
+static	int	   ecomp2c	(struct eprog *, int);
+static	int	   ecomp3	(struct eprog *, int);
+static	int	   ecomp3a	(struct eprog *, int);
+static	int	   ecomp4	(struct eprog *, int);
+static	int	   ecomp5	(struct eprog *, int);
+static	int	   ecomp6	(struct eprog *, int);
+static	int	   enode	(struct eprog *, int, int, int, int);
+static	tcsh_number_t  evaln	(struct eprog *, int, int);
+static	void	   evals	(struct eprog *, int, int, struct evalue *);
+static	Char	  *evalstr	(struct eprog *, int, int);
+static	tcsh_number_t  evnum	(struct evalue *);
+static	void	   evnumber	(struct evalue *, tcsh_number_t);
 
 #ifdef EDEBUG
 static	void	   etracc	(const char *, const Char *, Char ***);
@@ -80,6 +165,138 @@ static	void	   etraci	(const char *, tcsh_number_t, Char ***);
 #define etraci(A, B, C) ((void)0)
 #endif /* !EDEBUG */
 
+/*
+ * File tests keep what stat(), lstat() and access() said of a name in a
+ * small direct mapped cache, so that -e $f && -r $f && ! -d $f, or the
+ * filetest builtin, looks at each name once.  An entry serves the
+ * expression it was made in; ftbegin() starts the next one.  With
+ * filetestcache set to a number of seconds, an entry also serves later
+ * expressions for that long, unless ftflush() was called in between on
+ * a change of directory, a redirection or a { command } in the
+ * expression itself.
+ */
+#define FTCACHESIZE	16	/* A power of 2 */
+
+#define FT_STAT		0x10	/* ft_stat and ft_st are known */
+#define FT_LSTAT	0x20	/* ft_lstat and ft_lst are known */
+				/* R_OK, W_OK, X_OK: that bit of ft_access */
+struct ftcache {
+    Char   *ft_name;		/* NULL if the slot was never used */
+    unsigned int ft_scope;	/* The expression it was made in */
+    unsigned int ft_gen;
+    time_t  ft_time;
+    int     ft_known;
+    int     ft_stat;		/* What stat() returned */
+    int     ft_lstat;		/* What lstat() returned */
+    int     ft_access;		/* The modes sh_access() allowed */
+    ftstat_t ft_st;
+    ftstat_t ft_lst;
+};
+
+static struct ftcache ftcache[FTCACHESIZE];
+static unsigned int ftscope = 1;
+static unsigned int ftgen = 1;
+
+/*
+ * Start a new expression: names tested from now on are looked at again,
+ * unless filetestcache says the answers are still good
+ */
+void
+ftbegin(void)
+{
+    ftscope++;
+}
+
+/*
+ * Forget all answers, whatever filetestcache says
+ */
+void
+ftflush(void)
+{
+    ftgen++;
+}
+
+/* How many seconds $filetestcache keeps answers for */
+static time_t
+fttimeout(void)
+{
+    const Char *cp;
+    time_t ttl;
+
+    for (ttl = 0, cp = varval(STRfiletestcache); Isdigit(*cp); cp++)
+	ttl = ttl * 10 + *cp - '0';
+    return ttl;
+}
+
+static struct ftcache *
+ftentry(const Char *name)
+{
+    struct ftcache *fp;
+    unsigned int h = 0;
+    const Char *cp;
+
+    for (cp = name; *cp; cp++)
+	h = h * 33 + *cp;
+    fp = &ftcache[h & (FTCACHESIZE - 1)];
+    if (fp->ft_name != NULL && fp->ft_gen == ftgen && eq(fp->ft_name, name)) {
+	if (fp->ft_scope == ftscope)
+	    return fp;
+	if (fp->ft_time != 0 && time(NULL) - fp->ft_time < fttimeout()) {
+	    fp->ft_scope = ftscope;
+	    return fp;
+	}
+    }
+    else {
+	xfree(fp->ft_name);
+	fp->ft_name = Strsave(name);
+    }
+    fp->ft_scope = ftscope;
+    fp->ft_gen = ftgen;
+    /* Made without filetestcache, it never outlives its expression */
+    fp->ft_time = fttimeout() > 0 ? time(NULL) : 0;
+    fp->ft_known = 0;
+    fp->ft_access = 0;
+    return fp;
+}
+
+/* stat() or, with link set, lstat() name; NULL if that failed */
+static ftstat_t *
+ftstat(const Char *name, int link)
+{
+    struct ftcache *fp = ftentry(name);
+
+#ifdef S_IFLNK
+    if (link) {
+	if ((fp->ft_known & FT_LSTAT) == 0) {
+	    fp->ft_lstat = TCSH_LSTAT(short2str(name), &fp->ft_lst);
+	    fp->ft_known |= FT_LSTAT;
+	}
+	return fp->ft_lstat == -1 ? NULL : &fp->ft_lst;
+    }
+#else
+    USE(link);
+#endif /* S_IFLNK */
+    if ((fp->ft_known & FT_STAT) == 0) {
+	fp->ft_stat = TCSH_STAT(short2str(name), &fp->ft_st);
+	fp->ft_known |= FT_STAT;
+    }
+    return fp->ft_stat == -1 ? NULL : &fp->ft_st;
+}
+
+/* sh_access(), answered from the cache */
+static int
+ftaccess(const Char *name, int mode)
+{
+    struct ftcache *fp = ftentry(name);
+
+    if ((fp->ft_known & mode) == 0) {
+	if (sh_access(name, mode) == 0)
+	    fp->ft_access |= mode;
+	fp->ft_known |= mode;
+    }
+    return (fp->ft_access & mode) ? 0 : 1;
+}
+
 /*
  * shell access function according to POSIX and non POSIX
  * From Beto Appleton (beto@aixwiz.aix.ibm.com)
@@ -88,7 +305,7 @@ static int
 sh_access(const Char *fname, int mode)
 {
 #if defined(POSIX) && !defined(USE_ACCESS)
-    struct stat     statb;
+    ftstat_t *st;
 #endif /* POSIX */
     char *name = short2str(fname);
 
@@ -114,12 +331,13 @@ sh_access(const Char *fname, int mode)
     if (mode != W_OK && mode != X_OK)
 	return access(name, mode);
 
-    if (stat(name, &statb) == -1) 
+    if ((st = ftstat(fname, 0)) == NULL)
 	return 1;
+    name = short2str(fname);
 
     if (access(name, mode) == 0) {
 #ifdef S_ISDIR
-	if (S_ISDIR(statb.st_mode) && mode == X_OK)
+	if (S_ISDIR(st->st_mode) && mode == X_OK)
 	    return 0;
 #endif /* S_ISDIR */
 
@@ -138,10 +356,10 @@ sh_access(const Char *fname, int mode)
 
     } 
 
-    else if (euid == statb.st_uid)
+    else if (euid == st->st_uid)
 	mode <<= 6;
 
-    else if (egid == statb.st_gid)
+    else if (egid == st->st_gid)
 	mode <<= 3;
 
 # ifdef NGROUPS_MAX
@@ -168,7 +386,7 @@ sh_access(const Char *fname, int mode)
 	    groups = xmalloc(n * sizeof(*groups));
 	    n = getgroups((int) n, groups);
 	    while (--n >= 0)
-		if (groups[n] == statb.st_gid) {
+		if (groups[n] == st->st_gid) {
 		    mode <<= 3;
 		    break;
 		}
@@ -177,7 +395,7 @@ sh_access(const Char *fname, int mode)
     }
 # endif /* NGROUPS_MAX */
 
-    if (statb.st_mode & mode)
+    if (st->st_mode & mode)
 	return 0;
     else
 	return 1;
@@ -187,7 +405,17 @@ sh_access(const Char *fname, int mode)
 tcsh_number_t
 expr(Char ***vp)
 {
-    return (exp0(vp, 0));
+    struct eprog *ep;
+    tcsh_number_t i;
+
+    ftbegin();
+    if (whyles == NULL || compat_expr || (ep = eprogof(*vp)) == NULL ||
+	ep->ep_root < 0)
+	return (exp0(vp, 0));
+    ep->ep_words = *vp;
+    i = evaln(ep, ep->ep_root, 0);
+    *vp += ep->ep_used;
+    return (i);
 }
 
 tcsh_number_t
@@ -582,6 +810,7 @@ exp6(Char ***vp, int ignore)
 	    exitstat();
 	}
 	pwait();
+	ftflush();		/* The command may have changed the files */
 	cleanup_until(&faket);
 	etraci("exp6 {} status", egetn(varval(STRstatus)), vp);
 	return (putn(egetn(varval(STRstatus)) == 0));
@@ -609,22 +838,9 @@ exp6(Char ***vp, int ignore)
 Char *
 filetest(Char *cp, Char ***vp, int ignore)
 {
-#ifdef convex
-    struct cvxstat stb, *st = NULL;
-# define TCSH_STAT	stat64
-#else
-# define TCSH_STAT	stat
-    struct stat stb, *st = NULL;
-#endif /* convex */
-
+    ftstat_t stb, *st = NULL;
 #ifdef S_IFLNK
-# ifdef convex
-    struct cvxstat lstb, *lst = NULL;
-#  define TCSH_LSTAT lstat64
-# else
-#  define TCSH_LSTAT lstat
-    struct stat lstb, *lst = NULL;
-# endif /* convex */
+    ftstat_t *lst = NULL;
     char *filnam;
 #endif /* S_IFLNK */
 
@@ -688,15 +904,15 @@ filetest(Char *cp, Char ***vp, int ignore)
 	switch (*ft) {
 
 	case 'r':
-	    i = !sh_access(ep, R_OK);
+	    i = !ftaccess(ep, R_OK);
 	    break;
 
 	case 'w':
-	    i = !sh_access(ep, W_OK);
+	    i = !ftaccess(ep, W_OK);
 	    break;
 
 	case 'x':
-	    i = !sh_access(ep, X_OK);
+	    i = !ftaccess(ep, X_OK);
 	    break;
 
 	case 'X':	/* tcsh extension, name is an executable in the path
@@ -717,8 +933,7 @@ filetest(Char *cp, Char ***vp, int ignore)
 		 * avoid convex compiler bug.
 		 */
 		if (!lst) {
-		    lst = &lstb;
-		    if (TCSH_LSTAT(short2str(ep), lst) == -1) {
+		    if ((lst = ftstat(ep, 1)) == NULL) {
 			cleanup_until(ep);
 			return (Strsave(errval));
 		    }
@@ -732,8 +947,7 @@ filetest(Char *cp, Char ***vp, int ignore)
 		 * avoid convex compiler bug.
 		 */
 		if (!st) {
-		    st = &stb;
-		    if (TCSH_STAT(short2str(ep), st) == -1) {
+		    if ((st = ftstat(ep, 0)) == NULL) {
 			cleanup_until(ep);
 			return (Strsave(errval));
 		    }
@@ -775,7 +989,7 @@ filetest(Char *cp, Char ***vp, int ignore)
 
 	    case 'K' :
 #ifdef S_ISOFL
-	      i = stb.st_dm_key;
+	      i = st->st_dm_key;
 #else /* !S_ISOFL */
 	      i = 0;
 #endif /* S_ISOFL */
@@ -832,12 +1046,12 @@ filetest(Char *cp, Char ***vp, int ignore)
 
 #ifdef convex
 	    case 'R':
-		i = (stb.st_dmonflags & IMIGRATED) == IMIGRATED;
+		i = (st->st_dmonflags & IMIGRATED) == IMIGRATED;
 		break;
 #endif /* convex */
 
 	    case 's':
-		i = stb.st_size != 0;
+		i = st->st_size != 0;
 		break;
 
 	    case 'e':
@@ -1033,6 +1247,449 @@ egetn(const Char *cp)
     return (getn(cp));
 }
 
+/*
+ * Whether no step of exp0() .. exp6() would take cp for an operator,
+ * wherever it is
+ */
+static int
+eplain(const Char *cp)
+{
+    switch (*cp) {
+    case '(': case ')': case '!': case '~': case '^': case '"': case '|':
+    case '&': case '<': case '>': case '=': case '+': case '*': case '/':
+    case '%': case '{': case '}':
+	return 0;
+    case '-':
+	return cp[1] != '\0' && !any(FILETESTS, cp[1]) &&
+	    !any(FILEVALS, cp[1]);
+    default:
+	return 1;
+    }
+}
+
+static struct eprog *
+eprogof(Char **v)
+{
+    struct eprog *ep;
+    unsigned int h = 2166136261U;
+    size_t i, n;
+    const Char *cp;
+
+    for (n = 0; v[n] != NULL; n++) {
+	if (eplain(v[n]))
+	    h ^= 1;
+	else
+	    for (cp = v[n]; *cp; cp++) {
+		h ^= (unsigned int) *cp;
+		h *= 16777619U;
+	    }
+	h *= 16777619U;
+    }
+    if ((ep = eprogs[h % EPROGS]) != NULL && ep->ep_hval == h &&
+	ep->ep_nwords == n) {
+	for (i = 0; i < n; i++)
+	    if (ep->ep_sig[i] == NULL ? !eplain(v[i]) :
+		!eq(ep->ep_sig[i], v[i]))
+		break;
+	if (i == n)
+	    return ep;
+    }
+    if (ep != NULL) {
+	blkfree(ep->ep_sig);
+	xfree(ep->ep_nodes);
+	xfree(ep);
+	eprogs[h % EPROGS] = NULL;
+    }
+
+    ep = xcalloc(1, sizeof(*ep));
+    ep->ep_hval = h;
+    ep->ep_nwords = n;
+    ep->ep_sig = xcalloc(n + 1, sizeof(*ep->ep_sig));
+    for (i = 0; i < n; i++)
+	if (!eplain(v[i]))
+	    ep->ep_sig[i] = Strsave(v[i]);
+    /* A word taken makes at most its node, an EN_GETN and an EN_NULL */
+    ep->ep_nodes = xmalloc((3 * n + 3) * sizeof(*ep->ep_nodes));
+    /* ecomp0() and on see the operator words in ep_sig, the rest as NULL */
+    ep->ep_root = ecomp0(ep, 0);
+    if (ep->ep_fail)
+	ep->ep_root = -1;
+    ep->ep_used = ep->ep_pos;
+    eprogs[h % EPROGS] = ep;
+    return ep;
+}
+
+#define EWORD(ep) \
+    ((size_t) (ep)->ep_pos < (ep)->ep_nwords ? (ep)->ep_sig[(ep)->ep_pos] : \
+     NULL)
+#define EPLAIN(ep) \
+    ((size_t) (ep)->ep_pos < (ep)->ep_nwords && EWORD(ep) == NULL)
+
+static int
+enode(struct eprog *ep, int op, int code, int left, int right)
+{
+    struct enode *np = &ep->ep_nodes[ep->ep_nnodes];
+
+    if (ep->ep_fail)
+	return -1;
+    np->en_op = op;
+    np->en_code = code;
+    np->en_left = left;
+    np->en_right = right;
+    return ep->ep_nnodes++;
+}
+
+static int
+ecomp0(struct eprog *ep, int ignore)
+{
+    int p1 = ecomp1(ep, ignore);
+    Char   *w;
+
+    while (!ep->ep_fail && (w = EWORD(ep)) != NULL && eq(w, STRor2)) {
+	ep->ep_pos++;
+	p1 = enode(ep, EN_OR2, 0, p1, ecomp1(ep, 0));
+    }
+    return p1;
+}
+
+static int
+ecomp1(struct eprog *ep, int ignore)
+{
+    int p1 = ecomp2(ep, EN_OR, ignore);
+    Char   *w;
+
+    while (!ep->ep_fail && (w = EWORD(ep)) != NULL && eq(w, STRand2)) {
+	ep->ep_pos++;
+	p1 = enode(ep, EN_AND2, 0, p1, ecomp2(ep, EN_OR, 0));
+    }
+    return p1;
+}
+
+/* exp2x, exp2a and exp2b: | over ^ over & */
+static int
+ecomp2(struct eprog *ep, int op, int ignore)
+{
+    static const Char *const ops[] = { STRor, STRcaret, STRand };
+    Char   *w;
+    int p1;
+
+    p1 = op == EN_AND ? ecomp2c(ep, ignore) : ecomp2(ep, op + 1, ignore);
+    while (!ep->ep_fail && (w = EWORD(ep)) != NULL &&
+	   eq(w, ops[op - EN_OR])) {
+	ep->ep_pos++;
+	p1 = enode(ep, op, 0, p1, op == EN_AND ? ecomp2c(ep, ignore) :
+		   ecomp2(ep, op + 1, ignore));
+    }
+    return p1;
+}
+
+static int
+ecomp2c(struct eprog *ep, int ignore)
+{
+    int p1 = ecomp3(ep, ignore);
+    int i;
+
+    if (ep->ep_fail)
+	return -1;
+    if (EWORD(ep) && (i = isa(EWORD(ep), EQOP)) != 0) {
+	ep->ep_pos++;
+	if (i == EQMATCH || i == NOTEQMATCH)
+	    ignore |= TEXP_NOGLOB;
+	return enode(ep, EN_EQ, i, p1, ecomp3(ep, ignore));
+    }
+    return enode(ep, EN_GETN, 0, p1, -1);
+}
+
+static int
+ecomp3(struct eprog *ep, int ignore)
+{
+    int p1 = ecomp3a(ep, ignore);
+    Char   *w;
+    int i;
+
+    while (!ep->ep_fail && (w = EWORD(ep)) != NULL &&
+	   (i = isa(w, RELOP)) != 0) {
+	ep->ep_pos++;
+	if ((w = EWORD(ep)) != NULL && eq(w, STRequal))
+	    i |= 1, ep->ep_pos++;
+	p1 = enode(ep, EN_REL, i, p1, ecomp3a(ep, ignore));
+    }
+    return p1;
+}
+
+static int
+ecomp3a(struct eprog *ep, int ignore)
+{
+    int p1 = ecomp4(ep, ignore);
+    const Char *op = EWORD(ep);
+
+    if (!ep->ep_fail && op && any("<>", op[0]) && op[0] == op[1]) {
+	ep->ep_pos++;
+	p1 = enode(ep, EN_SHIFT, op[0], p1, ecomp4(ep, ignore));
+    }
+    return p1;
+}
+
+static int
+ecomp4(struct eprog *ep, int ignore)
+{
+    int p1 = ecomp5(ep, ignore);
+
+    while (!ep->ep_fail && EWORD(ep) && isa(EWORD(ep), ADDOP)) {
+	int op = EWORD(ep)[0];
+
+	ep->ep_pos++;
+	p1 = enode(ep, EN_ADD, op, p1, ecomp5(ep, ignore));
+    }
+    return p1;
+}
+
+static int
+ecomp5(struct eprog *ep, int ignore)
+{
+    int p1 = ecomp6(ep, ignore);
+
+    while (!ep->ep_fail && EWORD(ep) && isa(EWORD(ep), MULOP)) {
+	int op = EWORD(ep)[0];
+
+	if ((ignore & TEXP_NOGLOB) != 0)
+	    return enode(ep, EN_DROP, 0, p1, ep->ep_pos++);
+	ep->ep_pos++;
+	p1 = enode(ep, EN_MUL, op, p1, ecomp6(ep, ignore));
+    }
+    return p1;
+}
+
+static int
+ecomp6(struct eprog *ep, int ignore)
+{
+    const Char *cp;
+
+    if (ep->ep_fail || (size_t) ep->ep_pos >= ep->ep_nwords) {
+	ep->ep_fail = 1;
+	return -1;
+    }
+    if (EPLAIN(ep))
+	return enode(ep, (ignore & TEXP_NOGLOB) ? EN_WORD : EN_GLOB, 0,
+		     ep->ep_pos++, -1);
+    cp = EWORD(ep);
+    if (eq(cp, STRbang) || eq(cp, STRtilde)) {
+	ep->ep_pos++;
+	return enode(ep, *cp == '!' ? EN_NOT : EN_COMPL, 0,
+		     ecomp6(ep, ignore), -1);
+    }
+    if (eq(cp, STRLparen)) {
+	int p1;
+
+	ep->ep_pos++;
+	p1 = ecomp0(ep, ignore);
+	if (ep->ep_fail || EWORD(ep) == NULL || *EWORD(ep) != ')') {
+	    ep->ep_fail = 1;
+	    return -1;
+	}
+	ep->ep_pos++;
+	return enode(ep, EN_PAREN, 0, p1, -1);
+    }
+    if (eq(cp, STRLbrace) ||
+	(*cp == '-' && (any(FILETESTS, cp[1]) || any(FILEVALS, cp[1])))) {
+	ep->ep_fail = 1;
+	return -1;
+    }
+    if (isa(EWORD(ep), ANYOP))
+	return enode(ep, EN_NULL, 0, -1, -1);
+    return enode(ep, (ignore & TEXP_NOGLOB) ? EN_WORD : EN_GLOB, 0,
+		 ep->ep_pos++, -1);
+}
+
+static tcsh_number_t
+evnum(struct evalue *ev)
+{
+    return ev->ev_str ? egetn(ev->ev_str) : ev->ev_num;
+}
+
+/* The number node n gives, as exp0() .. exp2c() would */
+static tcsh_number_t
+evaln(struct eprog *ep, int n, int ignore)
+{
+    struct enode *np = &ep->ep_nodes[n];
+    tcsh_number_t p1, p2;
+    struct evalue ev;
+    Char *s1, *s2;
+
+    switch (np->en_op) {
+    case EN_OR2:
+	p1 = evaln(ep, np->en_left, ignore);
+	p2 = evaln(ep, np->en_right, (ignore & TEXP_IGNORE) || p1);
+	return (ignore & TEXP_IGNORE) ? p1 : (p1 || p2);
+    case EN_AND2:
+	p1 = evaln(ep, np->en_left, ignore);
+	p2 = evaln(ep, np->en_right, (ignore & TEXP_IGNORE) || !p1);
+	return (ignore & TEXP_IGNORE) ? p1 : (p1 && p2);
+    case EN_OR:
+    case EN_XOR:
+    case EN_AND:
+	p1 = evaln(ep, np->en_left, ignore);
+	p2 = evaln(ep, np->en_right, ignore);
+	if (ignore & TEXP_IGNORE)
+	    return p1;
+	return np->en_op == EN_OR ? (p1 | p2) :
+	    np->en_op == EN_XOR ? (p1 ^ p2) : (p1 & p2);
+    case EN_EQ:
+	s1 = evalstr(ep, np->en_left, ignore);
+	cleanup_push(s1, xfree);
+	s2 = evalstr(ep, np->en_right, ignore);
+	cleanup_push(s2, xfree);
+	p1 = np->en_code;
+	if (!(ignore & TEXP_IGNORE))
+	    switch (np->en_code) {
+	    case EQEQ:
+		p1 = eq(s1, s2);
+		break;
+	    case NOTEQ:
+		p1 = !eq(s1, s2);
+		break;
+	    case EQMATCH:
+		p1 = Gmatch(s1, s2);
+		break;
+	    case NOTEQMATCH:
+		p1 = !Gmatch(s1, s2);
+		break;
+	    }
+	cleanup_until(s1);
+	return p1;
+    case EN_GETN:
+	evals(ep, np->en_left, ignore, &ev);
+	if (ev.ev_str == NULL)
+	    return ev.ev_num;
+	cleanup_push(ev.ev_str, xfree);
+	p1 = egetn(ev.ev_str);
+	cleanup_until(ev.ev_str);
+	return p1;
+    default:
+	abort();
+    }
+}
+
+/* The string node n gives, as exp3() .. exp6() would */
+static void
+evals(struct eprog *ep, int n, int ignore, struct evalue *ev)
+{
+    struct enode *np = &ep->ep_nodes[n];
+    struct evalue e1, e2;
+    tcsh_number_t i = 0, i2;
+    Char **v;
+
+    ev->ev_str = NULL;
+    switch (np->en_op) {
+    case EN_NULL:
+	ev->ev_str = Strsave(STRNULL);
+	return;
+    case EN_WORD:
+	ev->ev_str = Strsave(ep->ep_words[np->en_left]);
+	return;
+    case EN_GLOB:
+	ev->ev_str = globone(ep->ep_words[np->en_left], G_APPEND);
+	return;
+    case EN_NOT:
+    case EN_COMPL:
+	evals(ep, np->en_left, ignore, &e1);
+	if (e1.ev_str != NULL)
+	    cleanup_push(e1.ev_str, xfree);
+	i = evnum(&e1);
+	if (e1.ev_str != NULL)
+	    cleanup_until(e1.ev_str);
+	evnumber(ev, np->en_op == EN_NOT ? !i : ~i);
+	return;
+    case EN_PAREN:
+	evnumber(ev, evaln(ep, np->en_left, ignore));
+	return;
+    case EN_DROP:
+	evals(ep, np->en_left, ignore, &e1);
+	xfree(e1.ev_str);
+	ev->ev_str = Strsave(ep->ep_words[np->en_right]);
+	return;
+    default:
+	break;
+    }
+
+    evals(ep, np->en_left, ignore, &e1);
+    if (e1.ev_str != NULL)
+	cleanup_push(e1.ev_str, xfree);
+    evals(ep, np->en_right, ignore, &e2);
+    if (e2.ev_str != NULL)
+	cleanup_push(e2.ev_str, xfree);
+    switch (np->en_op) {
+    case EN_REL:
+	i = np->en_code;
+	if (!(ignore & TEXP_IGNORE))
+	    switch (np->en_code) {
+	    case GTR:
+		i = evnum(&e1) > evnum(&e2);
+		break;
+	    case GTR | 1:
+		i = evnum(&e1) >= evnum(&e2);
+		break;
+	    case LSS:
+		i = evnum(&e1) < evnum(&e2);
+		break;
+	    case LSS | 1:
+		i = evnum(&e1) <= evnum(&e2);
+		break;
+	    }
+	break;
+    case EN_SHIFT:
+	if (np->en_code == '<')
+	    i = evnum(&e1) << evnum(&e2);
+	else
+	    i = evnum(&e1) >> evnum(&e2);
+	break;
+    case EN_ADD:
+	if (!(ignore & TEXP_IGNORE))
+	    i = np->en_code == '+' ? evnum(&e1) + evnum(&e2) :
+		evnum(&e1) - evnum(&e2);
+	break;
+    case EN_MUL:
+	if (ignore & TEXP_IGNORE)
+	    break;
+	if (np->en_code == '*') {
+	    i = evnum(&e1) * evnum(&e2);
+	    break;
+	}
+	i2 = evnum(&e2);
+	if (i2 == 0)
+	    stderror(np->en_code == '/' ? ERR_DIV0 : ERR_MOD0);
+	i = np->en_code == '/' ? evnum(&e1) / i2 : evnum(&e1) % i2;
+	break;
+    default:
+	abort();
+    }
+    if ((v = e1.ev_str ? &e1.ev_str : e2.ev_str ? &e2.ev_str : NULL) != NULL)
+	cleanup_until(*v);
+    evnumber(ev, i);
+}
+
+/*
+ * putn() cannot write the most negative number so that egetn() reads it
+ * back, so it gets the string exp3() .. exp6() would have made of it
+ */
+static void
+evnumber(struct evalue *ev, tcsh_number_t i)
+{
+    if (i < 0 && -(i + 1) == ENUMMAX)
+	ev->ev_str = putn(i);
+    else
+	ev->ev_num = i;
+}
+
+static Char *
+evalstr(struct eprog *ep, int n, int ignore)
+{
+    struct evalue ev;
+
+    evals(ep, n, ignore, &ev);
+    return ev.ev_str ? ev.ev_str : putn(ev.ev_num);
+}
+
 /* Phew! */
 
 #ifdef EDEBUG
@@ -230,6 +230,7 @@ dofiletest(Char **v, struct command *c)
     globbed = v;
     cleanup_push(globbed, blk_cleanup);
 
+    ftbegin();
     while (*(fileptr = v++) != '\0') {
 	res = filetest(ftest, &fileptr, 0);
 	cleanup_push(res, xfree);
@@ -272,6 +273,7 @@ doalias(Char **v, struct command *c)
 	    stderror(ERR_NAME | ERR_DANGER);
 	}
 	set1(strip(p), saveblk(v), &aliases, VAR_READWRITE);
+	aliasgen++;
 	tw_cmd_free();
     }
 }
@@ -282,6 +284,7 @@ unalias(Char **v, struct command *c)
 {
     USE(c);
     unset1(v, &aliases);
+    aliasgen++;
     tw_cmd_free();
 }
 
@@ -755,7 +758,7 @@ search(int type, int level, Char *goal)
     struct Strbuf word = Strbuf_INIT;
     Char *cp;
     struct whyle *wp;
-    int wlevel = 0;
+    int wlevel = 0, pops = 0, subst = 0;
     struct wordent *histent = NULL, *ohistent = NULL;
 
     Stype = type;
@@ -767,6 +770,13 @@ search(int type, int level, Char *goal)
 	a.a_seek = 0;
 	bseek(&a);
     }
+    if (srchhit(type, goal, &pops)) {
+	for (; pops > 0 && (wp = whyles) != NULL; pops--) {
+	    whyles = wp->w_next;
+	    wpfree(wp);
+	}
+	return;
+    }
     cleanup_push(&word, Strbuf_cleanup);
     do {
 	    
@@ -833,6 +843,7 @@ search(int type, int level, Char *goal)
 		    if (wp) {
 			    whyles = wp->w_next;
 			    wpfree(wp);
+			    pops++;
 		    }
 		}
 	    }
@@ -873,6 +884,8 @@ search(int type, int level, Char *goal)
 	    (void) getword(&word);
 	    if (word.len != 0 && word.s[word.len - 1] == ':')
 		word.s[--word.len] = 0;
+	    if (Strchr(word.s, '$') != NULL)
+		subst = 1;
 	    cp = strip(Dfix1(word.s));
 	    cleanup_push(cp, xfree);
 	    if (Gmatch(goal, cp))
@@ -896,6 +909,9 @@ search(int type, int level, Char *goal)
     } while (level >= 0);
  end:
     cleanup_until(&word);
+    /* Where a switch lands depends on its case labels being constant */
+    if (!subst)
+	srchsave(type, goal, pops);
 }
 
 static struct wordent *
@@ -1463,6 +1479,7 @@ dosetenv(Char **v, struct command *c)
 	fix_strcoll_bug();
 # endif /* STRCOLLBUG */
 	tw_cmd_free();	/* since the collation sequence has changed */
+	gmatchflush();
 	for (k = 0200; k <= 0377 && !Isprint(CTL_ESC(k)); k++)
 	    continue;
 	AsciiOnly = MB_CUR_MAX == 1 && k > 0377;
@@ -1671,6 +1688,7 @@ dounsetenv(Char **v, struct command *c)
 		    fix_strcoll_bug();
 # endif /* STRCOLLBUG */
 		    tw_cmd_free();/* since the collation sequence has changed */
+		    gmatchflush();
 		    for (k = 0200; k <= 0377 && !Isprint(CTL_ESC(k)); k++)
 			continue;
 		    AsciiOnly = MB_CUR_MAX == 1 && k > 0377;
@@ -1710,6 +1728,90 @@ dounsetenv(Char **v, struct command *c)
     cleanup_until(name);
 }
 
+/*
+ * The environment is kept twice, as Char strings in STR_environ for the
+ * shell and converted in environ for the programs it runs, with each
+ * entry at the same index in both.  envhash maps a name to that index,
+ * so setenv and unsetenv find and convert only the entry they change.
+ */
+#ifdef WINNT_NATIVE
+# define envcase(c)	Tolower((c) & TRIM)
+#else
+# define envcase(c)	samecase((c) & TRIM)
+#endif /* WINNT_NATIVE */
+
+static Char **envblk;		/* The STR_environ envhash was built for */
+static size_t envlen;		/* Entries in STR_environ and environ */
+static size_t envroom;		/* Entries they have room for */
+static size_t *envhash;		/* Index + 1 of each entry, 0 if empty */
+static size_t envhsize;		/* Slots in envhash, a power of 2 */
+
+static unsigned int
+envhval(const Char *s)
+{
+    unsigned int h = 2166136261U;
+
+    for (; *s && *s != '='; s++) {
+	h ^= (unsigned int) envcase(*s);
+	h *= 16777619U;
+    }
+    return h;
+}
+
+static size_t *
+envhslot(const Char *name)
+{
+    size_t h, *hp;
+    const Char *cp, *dp;
+
+    for (h = envhval(name); *(hp = &envhash[h & (envhsize - 1)]) != 0; h++) {
+	for (cp = name, dp = STR_environ[*hp - 1];
+	     *cp && envcase(*cp) == envcase(*dp); cp++, dp++)
+	    continue;
+	if (*cp == 0 && *dp == '=')
+	    break;
+    }
+    return hp;
+}
+
+static void
+envrehash(void)
+{
+    size_t h, i;
+
+    if (envhsize < 2 * envroom || envhsize < 64) {
+	xfree(envhash);
+	for (envhsize = 64; envhsize < 2 * envroom; envhsize *= 2)
+	    continue;
+	envhash = xcalloc(envhsize, sizeof(*envhash));
+    }
+    else
+	(void) memset(envhash, 0, envhsize * sizeof(*envhash));
+    /* Duplicates go further down the chain, so the first one is found */
+    for (i = 0; i < envlen; i++) {
+	for (h = envhval(STR_environ[i]); envhash[h & (envhsize - 1)]; h++)
+	    continue;
+	envhash[h & (envhsize - 1)] = i + 1;
+    }
+}
+
+/* The slot in STR_environ (and environ) of name, NULL if it is not set */
+Char **
+envfind(const Char *name)
+{
+    size_t *hp;
+
+    if (STR_environ == NULL)
+	return NULL;
+    if (STR_environ != envblk) {
+	envblk = STR_environ;
+	envroom = envlen = blklen(STR_environ);
+	envrehash();
+    }
+    hp = envhslot(name);
+    return *hp ? &STR_environ[*hp - 1] : NULL;
+}
+
 void
 tsetenv(const Char *name, const Char *val)
 {
@@ -1729,69 +1831,60 @@ tsetenv(const Char *name, const Char *val)
     setenv(cname, short2str(val), 1);
     xfree(cname);
 #else /* !SETENV_IN_LIB */
-    Char **ep = STR_environ;
-    const Char *ccp;
+    Char **ep;
     Char *cp, *dp;
-    Char   *blk[2];
-    Char  **oep = ep;
+    size_t i;
 
 #ifdef WINNT_NATIVE
     nt_set_env(name,val);
 #endif /* WINNT_NATIVE */
-    for (; *ep; ep++) {
-#ifdef WINNT_NATIVE
-	for (ccp = name, dp = *ep; *ccp && Tolower(*ccp & TRIM) == Tolower(*dp);
-				ccp++, dp++)
-#else
-	for (ccp = name, dp = *ep; *ccp && (*ccp & TRIM) == *dp; ccp++, dp++)
-#endif /* WINNT_NATIVE */
-	    continue;
-	if (*ccp != 0 || *dp != '=')
-	    continue;
-	cp = Strspl(STRequal, val);
+    ep = envfind(name);
+    dp = Strspl(name, STRequal);
+    cp = strip(Strspl(dp, val));
+    xfree(dp);
+    if (ep != NULL) {
+	i = ep - STR_environ;
 	xfree(*ep);
-	*ep = strip(Strspl(name, cp));
-	xfree(cp);
-	blkfree((Char **) environ);
-	environ = short2blk(STR_environ);
+	*ep = cp;
+	xfree(environ[i]);
+	environ[i] = strsave(short2str(cp));
 	return;
     }
-    cp = Strspl(name, STRequal);
-    blk[0] = strip(Strspl(cp, val));
-    xfree(cp);
-    blk[1] = 0;
-    STR_environ = blkspl(STR_environ, blk);
-    blkfree((Char **) environ);
-    environ = short2blk(STR_environ);
-    xfree(oep);
+    if (envlen == envroom) {
+	envroom = envroom * 2 + 16;
+	envblk = STR_environ = xrealloc(STR_environ,
+					(envroom + 1) * sizeof(*STR_environ));
+	environ = xrealloc(environ, (envroom + 1) * sizeof(*environ));
+	envrehash();
+    }
+    STR_environ[envlen] = cp;
+    environ[envlen] = strsave(short2str(cp));
+    *envhslot(name) = ++envlen;
+    STR_environ[envlen] = NULL;
+    environ[envlen] = NULL;
 #endif /* SETENV_IN_LIB */
 }
 
 void
 Unsetenv(Char *name)
 {
-    Char **ep = STR_environ;
-    Char *cp, *dp;
-    Char **oep = ep;
+    Char **ep;
+    size_t i;
 
 #ifdef WINNT_NATIVE
 	nt_set_env(name,NULL);
 #endif /*WINNT_NATIVE */
-    for (; *ep; ep++) {
-	for (cp = name, dp = *ep; *cp && *cp == *dp; cp++, dp++)
-	    continue;
-	if (*cp != 0 || *dp != '=')
-	    continue;
-	cp = *ep;
-	*ep = 0;
-	STR_environ = blkspl(STR_environ, ep + 1);
-	blkfree((Char **) environ);
-	environ = short2blk(STR_environ);
-	*ep = cp;
-	xfree(cp);
-	xfree(oep);
+    if ((ep = envfind(name)) == NULL)
 	return;
-    }
+    i = ep - STR_environ;
+    xfree(STR_environ[i]);
+    xfree(environ[i]);
+    (void) memmove(&STR_environ[i], &STR_environ[i + 1],
+		   (envlen - i) * sizeof(*STR_environ));
+    (void) memmove(&environ[i], &environ[i + 1],
+		   (envlen - i) * sizeof(*environ));
+    envlen--;
+    envrehash();
 }
 
 /*ARGSUSED*/
@@ -64,6 +64,54 @@ RCSID("$tcsh$")
  * handled in glob() which is part of the 4.4BSD libc.
  *
  */
+/*
+ * Gmatch() and Gnmatch() compile a pattern once into the alternatives its
+ * braces expand to, each a list of steps, and keep the last GPATS of them
+ * by text: switch labels, =~, complete and fignore match many strings
+ * against the same few patterns.  Which characters below 256 a [...] set
+ * holds is remembered as they are tested; since that depends on the
+ * collating order, a change of locale flushes them all.
+ */
+#define	GPATS		64	/* A power of 2 */
+
+#define	GS_END		0
+#define	GS_CHAR		1
+#define	GS_ONE		2	/* ? */
+#define	GS_STAR		3	/* * */
+#define	GS_SET		4	/* [...] */
+#define	GS_BADSET	5	/* [ with no ], an error only if reached */
+
+struct gclass {
+    int     gc_negate;
+    size_t  gc_nrange;
+    Char   *gc_range;		/* First and last, or a character and 0 */
+    unsigned char gc_known[32];	/* Characters below 256 tested so far */
+    unsigned char gc_in[32];	/* and those of them in the set */
+};
+
+struct gstep {
+    int     gs_op;
+    Char    gs_c;		/* GS_CHAR */
+    struct gclass *gs_class;	/* GS_SET */
+};
+
+struct galt {			/* One alternative of the braces */
+    struct gstep *ga_steps;
+    size_t  ga_min;		/* The characters it takes at least */
+    size_t  ga_tail;		/* Plain characters it ends with */
+    int     ga_star;		/* Whether it has a * */
+    int     ga_bad;		/* Whether it has a GS_BADSET */
+};
+
+struct gpat {
+    Char   *gp_text;
+    int     gp_pol;		/* 0 if it starts with ^ */
+    struct galt *gp_alts;
+    int     gp_nalts;
+};
+
+static struct gpat *gpats[GPATS];
+
 static	Char	 *globtilde	(Char *);
 static	Char     *handleone	(Char *, Char **, int);
 static	Char	**libglob	(Char **);
@@ -73,6 +121,14 @@ static  void	  expbrace	(Char ***, Char ***, int);
 static	void	  pword		(struct blk_buf *, struct Strbuf *);
 static	void	  backeval	(struct blk_buf *, struct Strbuf *, Char *,
 				 int);
+static	struct gpat *gpatof	(const Char *);
+static	void	  gpatfree	(struct gpat *);
+static	void	  galtcomp	(struct galt *, const Char *);
+static	int	  galtmatch	(const struct galt *, const Char *);
+static	int	  gstarmatch	(const Char *, const struct gstep *);
+static	int	  gpmatch	(const Char *, const struct gstep *,
+				 const Char **);
+static	int	  gclassin	(struct gclass *, Char);
 static Char *
 globtilde(Char *s)
 {
@@ -443,6 +499,11 @@ libglob(Char **vl)
     globv.gl_offs = 0;
     globv.gl_pathv = 0;
     globv.gl_pathc = 0;
+    globv.gl_nthreads = 0;
+    if ((gflgs & GLOB_STAR) && adrof(STRglobthreads) != NULL) {
+	ptr = short2str(varval(STRglobthreads));
+	globv.gl_nthreads = *ptr ? atoi(ptr) : GLOB_THREADSDEF;
+    }
 
     if (nonomatch)
 	gflgs |= GLOB_NOCHECK;
@@ -889,34 +950,22 @@ Gmatch(const Char *string, const Char *pattern)
 int
 Gnmatch(const Char *string, const Char *pattern, const Char **endstr)
 {
-    Char ***fblk, **p;
+    struct gpat *gp;
     const Char *tstring = string;
-    int	   gpol = 1, gres = 0;
-
-    if (*pattern == '^') {
-	gpol = 0;
-	pattern++;
-    }
-
-    fblk = xmalloc(sizeof(Char ***));
-    *fblk = xmalloc(GLOBSPACE * sizeof(Char *));
-    (*fblk)[0] = Strsave(pattern);
-    (*fblk)[1] = NULL;
-
-    cleanup_push(fblk, blk_indirect_cleanup);
-    expbrace(fblk, NULL, GLOBSPACE);
+    int	   i, gres = 0;
 
+    gp = gpatof(pattern);
     if (endstr == NULL)
 	/* Exact matches only */
-	for (p = *fblk; *p; p++) 
-	    gres |= t_pmatch(string, *p, &tstring, 1) == 2 ? 1 : 0;
+	for (i = 0; i < gp->gp_nalts; i++)
+	    gres |= galtmatch(&gp->gp_alts[i], string);
     else {
 	const Char *end;
 
 	/* partial matches */
         end = Strend(string);
-	for (p = *fblk; *p; p++)
-	    if (t_pmatch(string, *p, &tstring, 1) != 0) {
+	for (i = 0; i < gp->gp_nalts; i++)
+	    if (gpmatch(string, gp->gp_alts[i].ga_steps, &tstring) != 0) {
 		gres |= 1;
 		if (end > tstring)
 		    end = tstring;
@@ -924,10 +973,331 @@ Gnmatch(const Char *string, const Char *pattern, const Char **endstr)
 	*endstr = end;
     }
 
-    cleanup_until(fblk);
-    return(gres == gpol);
+    return(gres == gp->gp_pol);
 } 
 
+/*
+ * Forget the compiled patterns, as the locale has changed
+ */
+void
+gmatchflush(void)
+{
+    int i;
+
+    for (i = 0; i < GPATS; i++)
+	if (gpats[i] != NULL) {
+	    gpatfree(gpats[i]);
+	    gpats[i] = NULL;
+	}
+}
+
+/*
+ * The compiled form of pattern, from the cache if it is there
+ */
+static struct gpat *
+gpatof(const Char *pattern)
+{
+    struct gpat *gp, **gpp;
+    const Char *p;
+    Char ***fblk;
+    unsigned int h = 0;
+    int pol = 1;
+
+    for (p = pattern; *p; p++)
+	h = h * 33 + *p;
+    gpp = &gpats[h & (GPATS - 1)];
+    if (*gpp != NULL && Strcmp((*gpp)->gp_text, pattern) == 0)
+	return *gpp;
+
+    p = pattern;
+    if (*p == '^') {
+	pol = 0;
+	p++;
+    }
+    fblk = xmalloc(sizeof(Char ***));
+    *fblk = xmalloc(GLOBSPACE * sizeof(Char *));
+    (*fblk)[0] = Strsave(p);
+    (*fblk)[1] = NULL;
+
+    cleanup_push(fblk, blk_indirect_cleanup);
+    expbrace(fblk, NULL, GLOBSPACE);
+
+    gp = xmalloc(sizeof(*gp));
+    gp->gp_text = Strsave(pattern);
+    gp->gp_pol = pol;
+    gp->gp_nalts = blklen(*fblk);
+    gp->gp_alts = xcalloc(gp->gp_nalts, sizeof(*gp->gp_alts));
+    for (h = 0; h < (unsigned int) gp->gp_nalts; h++)
+	galtcomp(&gp->gp_alts[h], (*fblk)[h]);
+    cleanup_until(fblk);
+
+    if (*gpp != NULL)
+	gpatfree(*gpp);
+    return *gpp = gp;
+}
+
+static void
+gpatfree(struct gpat *gp)
+{
+    struct gstep *gs;
+    int i;
+
+    for (i = 0; i < gp->gp_nalts; i++) {
+	for (gs = gp->gp_alts[i].ga_steps; gs->gs_op != GS_END; gs++)
+	    if (gs->gs_op == GS_SET) {
+		xfree(gs->gs_class->gc_range);
+		xfree(gs->gs_class);
+	    }
+	xfree(gp->gp_alts[i].ga_steps);
+    }
+    xfree(gp->gp_alts);
+    xfree(gp->gp_text);
+    xfree(gp);
+}
+
+/*
+ * Compile one alternative, reading it just as t_pmatch() does
+ */
+static void
+galtcomp(struct galt *ga, const Char *pattern)
+{
+    struct gstep *gs;
+    struct gclass *gc;
+    Char patternc, rangec;
+
+    gs = ga->ga_steps = xmalloc((Strlen(pattern) + 2) * sizeof(*gs));
+    for (;; gs++) {
+	patternc = *pattern++ & TRIM;
+	switch (patternc) {
+	case '\0':
+	    gs->gs_op = GS_END;
+	    break;
+	case '?':
+	    gs->gs_op = GS_ONE;
+	    ga->ga_min++;
+	    ga->ga_tail = 0;
+	    continue;
+	case '*':
+	    gs->gs_op = GS_STAR;
+	    ga->ga_star = 1;
+	    ga->ga_tail = 0;
+	    continue;
+	case '[':
+	    gc = xmalloc(sizeof(*gc));
+	    gc->gc_range = xmalloc((Strlen(pattern) + 1) * 2 * sizeof(Char));
+	    gc->gc_nrange = 0;
+	    (void) memset(gc->gc_known, 0, sizeof(gc->gc_known));
+	    if ((gc->gc_negate = (*pattern == '^')) != 0)
+		pattern++;
+	    while ((rangec = *pattern++ & TRIM) != '\0') {
+		if (rangec == ']')
+		    break;
+		gc->gc_range[2 * gc->gc_nrange] = rangec;
+		gc->gc_range[2 * gc->gc_nrange + 1] = '\0';
+		if (*pattern == '-' && pattern[1] != ']') {
+		    pattern++;
+		    if ((rangec = *pattern++ & TRIM) == '\0')
+			break;
+		    gc->gc_range[2 * gc->gc_nrange + 1] = rangec;
+		}
+		gc->gc_nrange++;
+	    }
+	    if (rangec == '\0') {
+		xfree(gc->gc_range);
+		xfree(gc);
+		gs->gs_op = GS_BADSET;
+		ga->ga_bad = 1;
+		(++gs)->gs_op = GS_END;
+		break;
+	    }
+	    gs->gs_op = GS_SET;
+	    gs->gs_class = gc;
+	    ga->ga_min++;
+	    ga->ga_tail = 0;
+	    continue;
+	default:
+	    gs->gs_op = GS_CHAR;
+	    gs->gs_c = patternc;
+	    ga->ga_min++;
+	    ga->ga_tail++;
+	    continue;
+	}
+	break;
+    }
+}
+
+/*
+ * Whether string matches the alternative ga exactly
+ */
+static int
+galtmatch(const struct galt *ga, const Char *string)
+{
+    const struct gstep *gs;
+    const Char *estr;
+    size_t len;
+
+    /* Reaching a [ with no ] is an error, so do just what t_pmatch() does */
+    if (ga->ga_bad)
+	return gpmatch(string, ga->ga_steps, &estr) == 2;
+
+    /* Too short or too long, or without the characters it must end with */
+    for (len = 0; string[len] & TRIM; len++)
+	continue;
+    if (ga->ga_star ? len < ga->ga_min : len != ga->ga_min)
+	return 0;
+    for (gs = ga->ga_steps; gs->gs_op != GS_END; gs++)
+	continue;
+    for (estr = string + len; estr > string + len - ga->ga_tail; )
+	if ((*--estr & TRIM) != (--gs)->gs_c)
+	    return 0;
+
+    return gstarmatch(string, ga->ga_steps);
+}
+
+/*
+ * Match string against the steps, going back to the last * on a mismatch
+ */
+static int
+gstarmatch(const Char *string, const struct gstep *gs)
+{
+    const struct gstep *sgs = NULL;
+    const Char *sstring = NULL;
+    Char stringc;
+    int ok;
+
+    for (;;) {
+	if (gs->gs_op == GS_STAR) {
+	    while (gs->gs_op == GS_STAR)
+		gs++;
+	    if (gs->gs_op == GS_END)
+		return 1;
+	    sgs = gs;
+	    sstring = string;
+	    continue;
+	}
+	stringc = *string & TRIM;
+	switch (gs->gs_op) {
+	case GS_END:
+	    ok = stringc == '\0';
+	    if (ok)
+		return 1;
+	    break;
+	case GS_ONE:
+	    ok = stringc != '\0';
+	    break;
+	case GS_SET:
+	    ok = stringc != '\0' &&
+		gclassin(gs->gs_class, stringc) != gs->gs_class->gc_negate;
+	    break;
+	default:
+	    ok = stringc == gs->gs_c;
+	    break;
+	}
+	if (ok) {
+	    string++;
+	    gs++;
+	}
+	else if (sgs == NULL || (*sstring & TRIM) == '\0')
+	    return 0;
+	else {
+	    string = ++sstring;
+	    gs = sgs;
+	}
+    }
+}
+
+/*
+ * t_pmatch(), case sensitive, on compiled steps
+ */
+static int
+gpmatch(const Char *string, const struct gstep *gs, const Char **estr)
+{
+    Char stringc;
+    const Char *pestr, *nstring;
+
+    for (nstring = string;; string = nstring, gs++) {
+	stringc = *nstring++ & TRIM;
+	switch (gs->gs_op) {
+	case GS_END:
+	    *estr = string;
+	    return (stringc == '\0' ? 2 : 1);
+	case GS_ONE:
+	    if (stringc == 0)
+		return (0);
+	    break;
+	case GS_STAR:
+	    if (gs[1].gs_op == GS_END) {
+		*estr = Strend(string);
+		return (2);
+	    }
+	    pestr = NULL;
+
+	    for (;;) {
+		switch(gpmatch(string, gs + 1, estr)) {
+		case 0:
+		    break;
+		case 1:
+		    pestr = *estr;
+		    break;
+		case 2:
+		    return 2;
+		default:
+		    abort();	/* Cannot happen */
+		}
+		stringc = *string++ & TRIM;
+		if (!stringc)
+		    break;
+	    }
+
+	    if (pestr) {
+		*estr = pestr;
+		return 1;
+	    }
+	    else
+		return 0;
+	case GS_SET:
+	    if (stringc == '\0' ||
+		gclassin(gs->gs_class, stringc) == gs->gs_class->gc_negate)
+		return (0);
+	    break;
+	case GS_BADSET:
+	    stderror(ERR_NAME | ERR_MISSING, ']');
+	    break;
+	default:
+	    if (gs->gs_c != stringc)
+		return (0);
+	    break;
+	}
+    }
+}
+
+/*
+ * Whether c, which is not 0, is one of the characters or ranges of gc
+ */
+static int
+gclassin(struct gclass *gc, Char c)
+{
+    const Char *r;
+    size_t i;
+    int in = 0;
+
+    if (c < 256 && (gc->gc_known[c >> 3] & (1 << (c & 7))))
+	return (gc->gc_in[c >> 3] >> (c & 7)) & 1;
+    for (i = 0, r = gc->gc_range; i < gc->gc_nrange && !in; i++, r += 2)
+	if (r[1] == '\0')
+	    in = c == r[0];
+	else
+	    in = globcharcoll(c, r[1], 0) <= 0 && globcharcoll(r[0], c, 0) <= 0;
+    if (c < 256) {
+	gc->gc_known[c >> 3] |= 1 << (c & 7);
+	if (in)
+	    gc->gc_in[c >> 3] |= 1 << (c & 7);
+	else
+	    gc->gc_in[c >> 3] &= ~(1 << (c & 7));
+    }
+    return in;
+}
+
 /* t_pmatch():
  *	Return 2 on exact match, 	
  *	Return 1 on substring match.
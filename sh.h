@@ -204,6 +204,7 @@ static __inline void tcsh_ignore(intptr_t a)
  * commands.
  */
 #define	FSAFE	5		/* We keep the first 5 descriptors untouched */
+#define	FSHWATCH 14		/* inotify watches of the path directories */
 #define	FSHTTY	15		/* /dev/tty when manip pgrps */
 #define	FSHIN	16		/* Preferred desc for shell input */
 #define	FSHOUT	17		/* ... shell output */
@@ -569,6 +570,7 @@ EXTERN int    pjobs IZERO;	/* want to print jobs if interrupted */
 EXTERN int    setintr IZERO;	/* Set interrupts on/off -> Wait intr... */
 EXTERN int    handle_interrupt IZERO;/* Are we currently handling an interrupt? */
 EXTERN int    havhash IZERO;	/* path hashing is available */
+EXTERN int    havwatch IZERO;	/* FSHWATCH watches the path directories */
 EXTERN int    editing IZERO;	/* doing filename expansion and line editing */
 EXTERN int    noediting IZERO;	/* initial $term defaulted to noedit */
 EXTERN int    bslash_quote IZERO;/* PWP: tcsh-style quoting?  (in sh.c) */
@@ -579,6 +581,7 @@ EXTERN int    isdiagatty IZERO;/* is SHDIAG a tty */
 EXTERN int    is1atty IZERO;	/* is file descriptor 1 a tty (didfds mode) */
 EXTERN int    is2atty IZERO;	/* is file descriptor 2 a tty (didfds mode) */
 EXTERN int    arun IZERO;	/* Currently running multi-line-aliases */
+EXTERN int    aliasgen IZERO;	/* Bumped whenever an alias changes */
 EXTERN int    implicit_cd IZERO;/* implicit cd enabled?(1=enabled,2=verbose) */
 EXTERN int    cdtohome IZERO;	/* cd without args goes home */
 EXTERN int    inheredoc IZERO;	/* Currently parsing a heredoc */
@@ -775,6 +778,9 @@ EXTERN int     AsciiOnly;	/* If set only 7 bits expected in characters */
  *
  * If (!cantell), all offsets are character offsets; if (!WIDE_STRINGS), there
  * is no difference between byte and character offsets.
+ *
+ * If (fmapped), the whole of a seekable file is in fbuf[0], indexed by byte
+ * offset from fbobp, and fseekp and feobp are byte offsets too.
  */
 EXTERN struct Bin {
     off_t   Bfseekp;		/* Seek pointer, generally != lseek() value */
@@ -785,7 +791,13 @@ EXTERN struct Bin {
 #ifdef WIDE_STRINGS
     /* Number of bytes in each character if (cantell) */
     unsigned char Bfclens[BUFSIZE + 1];
+    /* Same for each byte offset of the whole file if (fmapped) */
+    unsigned char *Bfmlens;
 #endif
+    int     Bfmapped;		/* The file is all decoded in fbuf[0] */
+    struct loopline **Bfloop;	/* Lines parsed inside loops, by offset */
+    struct srchline **Bfsrch;	/* Where search() went, by offset */
+    struct comp *Bfcomp;	/* Compiled form of a sourced file */
 }       B;
 
 /*
@@ -817,6 +829,11 @@ extern int aret;		/* Type of last char returned */
 #define	fblocks	B.Bfblocks
 #define	fbuf	B.Bfbuf
 #define fclens  B.Bfclens
+#define fmlens  B.Bfmlens
+#define fmapped B.Bfmapped
+#define floop	B.Bfloop
+#define fsrch	B.Bfsrch
+#define fcomp	B.Bfcomp
 
 /*
  * The shell finds commands in loops by reseeking the input
@@ -1003,8 +1020,15 @@ EXTERN struct varent {
 #define VAR_NOGLOB	4
 #define VAR_FIRST       32
 #define VAR_LAST        64
+#define VAR_NUMBER	128	/* v_num is the single word of vec */
     struct varent *v_link[3];	/* The links, see below */
     int     v_bal;		/* Balance factor */
+    struct varent *v_hnext;	/* Next in its hash chain */
+    unsigned int v_hval;	/* Hash of v_name */
+    tcsh_number_t v_num;	/* Value stored by @, if VAR_NUMBER */
+    Char  **v_base;		/* The array vec is in, if shift moved vec */
+    size_t  v_room;		/* Words vec has room for, 0 if not known */
+    size_t  v_len;		/* blklen(vec), if v_room is known */
 }       shvhed IZERO_STRUCT, aliases IZERO_STRUCT;
 
 #define v_left		v_link[0]
@@ -1066,6 +1090,7 @@ EXTERN struct Hist {
     Char   *histline;
     struct Hist *Hnext, *Hprev;         /* doubly linked list */
     unsigned Hhash;                     /* hash value of command line */
+    unsigned Hseq;			/* order in the search index */
 }       Histlist IZERO_STRUCT;
 
 extern struct wordent paraml;	/* Current lexical word list */
@@ -38,13 +38,32 @@ RCSID("$tcsh$")
 #include <assert.h>
 #include "tc.h"
 #include "dotlock.h"
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif /* HAVE_MMAP */
+#if defined(F_OFD_SETLKW) || defined(HAVE_FLOCK)
+# define HISTLOCK	/* Wait for a lock on the history file itself */
+# ifndef F_OFD_SETLKW
+#  include <sys/file.h>
+# endif /* !F_OFD_SETLKW */
+#endif /* F_OFD_SETLKW || HAVE_FLOCK */
 
 extern int histvalid;
+extern int enterhist;
 extern struct Strbuf histline;
 Char HistLit = 0;
 
 static	int	heq	(const struct wordent *, const struct wordent *);
 static	void	hfree	(struct Hist *);
+static	int	savehistopt	(const Char *);
+static	Char   *histfilename	(void);
+static	void	histappend	(struct Hist *);
+#ifdef HISTLOCK
+static	int	histlock	(int);
+#endif /* HISTLOCK */
+static	void	histbinrec	(struct strbuf *, struct Hist *);
+static	void	histbinwrite	(int, Char *);
+static	int	histbinload	(const char *, int);
 
 #define HIST_ONLY	0x01
 #define HIST_SAVE	0x02
@@ -73,9 +92,233 @@ static unsigned histCount = 0;		/* number elements on history list */
 static int histlen = 0;
 static struct Hist *histTail = NULL;     /* last element on history list */
 static struct Hist *histMerg = NULL;	 /* last element merged by Htime */
+static unsigned histFileCount = 0;	 /* events in the history file */
 
 static void insertHistHashTable(struct Hist *, unsigned);
 
+/*
+ * The trigram index of the history list, which findev() and the editor's
+ * history searches use to look only at the events that could match.  Each
+ * of HISTGRAMS buckets has the events with a trigram hashing to it in their
+ * text, oldest first.  The text is that of sprlex(), and the words as they
+ * are, and histline, so that whichever is matched is covered.  Events are
+ * numbered in Hseq in the order of the list as they are indexed, so that a
+ * bucket can be searched from any event on.  The index is built on the
+ * first search, kept as events come and go, and built again after an event
+ * is put anywhere but at the head of the list, as merging does.
+ */
+#define HISTGRAMS	4096		/* A power of two */
+
+struct histgram {
+    struct Hist **v;			/* Events, in v[start] to v[len - 1] */
+    size_t  start, len, size;
+    unsigned seen;			/* histgramgen when last hashed to */
+};
+
+static struct histgram *histgrams = NULL;
+static int histgramok = 0;		/* Whether the index is up to date */
+static unsigned histgramgen = 0;
+static unsigned histseq = 0;
+static struct histgram *histgramq = NULL; /* Bucket being searched */
+
+static unsigned
+histgramhash(Char a, Char b, Char c)
+{
+    uint32_t h;
+
+    h = ((uint32_t) (a & TRIM) * 0x9e3779b1U) ^
+	((uint32_t) (b & TRIM) * 0x85ebca77U) ^ ((uint32_t) (c & TRIM) * 0xc2b2ae3dU);
+    return (h ^ (h >> 15)) & (HISTGRAMS - 1);
+}
+
+/* Binary search hg for the first event with Hseq at least seq. */
+static size_t
+histgramfind(const struct histgram *hg, unsigned seq)
+{
+    size_t lo = hg->start, hi = hg->len, mid;
+
+    while (lo < hi) {
+	mid = lo + (hi - lo) / 2;
+	if (hg->v[mid]->Hseq < seq)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
+/* Add hp to, or with del delete it from, the bucket of trigram abc. */
+static void
+histgramadd(struct Hist *hp, Char a, Char b, Char c, int del)
+{
+    struct histgram *hg;
+    size_t i;
+
+    hg = &histgrams[histgramhash(a, b, c)];
+    if (hg->seen == histgramgen)
+	return;
+    hg->seen = histgramgen;
+    if (del) {
+	i = histgramfind(hg, hp->Hseq);
+	if (i == hg->len || hg->v[i] != hp)
+	    return;
+	if (i == hg->start)
+	    hg->start++;
+	else {
+	    (void) memmove(&hg->v[i], &hg->v[i + 1],
+			   (hg->len - i - 1) * sizeof(*hg->v));
+	    hg->len--;
+	}
+	return;
+    }
+    if (hg->len == hg->size) {
+	if (hg->start > hg->len / 2) {
+	    (void) memmove(hg->v, &hg->v[hg->start],
+			   (hg->len - hg->start) * sizeof(*hg->v));
+	    hg->len -= hg->start;
+	    hg->start = 0;
+	}
+	else {
+	    hg->size = hg->size ? 2 * hg->size : 8;
+	    hg->v = xrealloc(hg->v, hg->size * sizeof(*hg->v));
+	}
+    }
+    hg->v[hg->len++] = hp;
+}
+
+/* Add hp to, or with del delete it from, the buckets of its text. */
+static void
+histgramhist(struct Hist *hp, int del)
+{
+    const struct wordent *wp, *last;
+    Char *s, *p, w[3] = { 0, 0, 0 };
+    int n;
+
+    if (++histgramgen == 0)
+	histgramgen++;
+    s = sprlex(&hp->Hlex);
+    for (p = s; p[0] && p[1] && p[2]; p++)
+	histgramadd(hp, p[0], p[1], p[2], del);
+    xfree(s);
+    /* The words without the quoting sprlex() adds, as findev() sees them */
+    n = 0;
+    last = hp->Hlex.prev;
+    for (wp = hp->Hlex.next; wp != last; wp = wp->next) {
+	for (p = wp->word; ; p++) {
+	    w[0] = w[1], w[1] = w[2];
+	    w[2] = *p ? *p : ' ';
+	    if (++n >= 3)
+		histgramadd(hp, w[0], w[1], w[2], del);
+	    if (*p == '\0')
+		break;
+	}
+    }
+    if ((p = hp->histline) != NULL)
+	for (; p[0] && p[1] && p[2]; p++)
+	    histgramadd(hp, p[0], p[1], p[2], del);
+}
+
+/* Index hp, just put at the head of the list. */
+static void
+histgramins(struct Hist *hp, struct Hist *pp)
+{
+    if (!histgramok)
+	return;
+    if (pp != &Histlist) {
+	histgramok = 0;			/* Out of order, so build it again */
+	return;
+    }
+    hp->Hseq = ++histseq;
+    histgramhist(hp, 0);
+}
+
+/* Take hp, about to be removed from the list, out of the index. */
+static void
+histgramrem(struct Hist *hp)
+{
+    if (histgramok)
+	histgramhist(hp, 1);
+}
+
+/* Build the index if it is not up to date. */
+static void
+histgramsync(void)
+{
+    struct Hist *hp;
+    size_t i;
+
+    if (histgramok)
+	return;
+    if (histgrams == NULL)
+	histgrams = xcalloc(HISTGRAMS, sizeof(*histgrams));
+    for (i = 0; i < HISTGRAMS; i++)
+	histgrams[i].start = histgrams[i].len = 0;
+    histseq = 0;
+    for (hp = histTail; hp != NULL && hp != &Histlist; hp = hp->Hprev) {
+	hp->Hseq = ++histseq;
+	histgramhist(hp, 0);
+    }
+    histgramok = 1;
+}
+
+/*
+ * Start a search of the history list for the events that might contain
+ * pat, or with glob might match it as a pattern of c_hmatch() in the
+ * editor, and return 1; or 0 if there is nothing in it to look up, and
+ * the list must be searched in full.
+ */
+int
+histgramset(const Char *pat, int glob)
+{
+    struct histgram *hg;
+    const Char *p;
+    int run = 0;
+
+    histgramq = NULL;
+    if (glob && (*pat == '^' || Strchr(pat, '{') != NULL))
+	return 0;			/* No words it must contain */
+    histgramsync();
+    for (p = pat; *p; p++) {
+	if (glob && (*p == '*' || *p == '?' || *p == '[')) {
+	    if (*p == '[')		/* Skip the set, as t_pmatch() does */
+		while (p[1] && *++p != ']')
+		    continue;
+	    run = 0;
+	    continue;
+	}
+	if (++run < 3)
+	    continue;
+	hg = &histgrams[histgramhash(p[-2], p[-1], p[0])];
+	if (histgramq == NULL ||
+	    hg->len - hg->start < histgramq->len - histgramq->start)
+	    histgramq = hg;
+    }
+    return histgramq != NULL;
+}
+
+/*
+ * The next event of the search begun by histgramset() further down the
+ * list than hp, or from the head if hp is NULL; NULL if there is none.
+ */
+struct Hist *
+histgramnext(struct Hist *hp)
+{
+    size_t i;
+
+    i = hp ? histgramfind(histgramq, hp->Hseq) : histgramq->len;
+    return i > histgramq->start ? histgramq->v[i - 1] : NULL;
+}
+
+/* Likewise, the next event further up the list than hp, or from the tail. */
+struct Hist *
+histgramprev(struct Hist *hp)
+{
+    size_t i;
+
+    i = hp ? histgramfind(histgramq, hp->Hseq + 1) : histgramq->start;
+    return i < histgramq->len ? histgramq->v[i] : NULL;
+}
+
 /* Insert new element (hp) in history list after specified predecessor (pp). */
 static void
 hinsert(struct Hist *hp, struct Hist *pp)
@@ -88,6 +331,7 @@ hinsert(struct Hist *hp, struct Hist *pp)
     else
         histTail = hp;                  /* meaning hp->Hnext == NULL */
     histCount++;
+    histgramins(hp, pp);
 }
 
 /* Remove the entry from the history list. */
@@ -96,6 +340,7 @@ hremove(struct Hist *hp)
 {
     struct Hist *pp = hp->Hprev;
     assert(pp);                         /* elements always have a previous */
+    histgramrem(hp);
     pp->Hnext = hp->Hnext;
     if (hp->Hnext)
         hp->Hnext->Hprev = pp;
@@ -147,11 +392,18 @@ savehist(
   struct wordent *sp,
   int mflg)				/* true if -m (merge) specified */
 {
+    struct Hist *hp;
+
     /* throw away null lines */
     if (sp && sp->next->word[0] == '\n')
 	return;
-    if (sp)
-        (void) enthist(++eventno, sp, 1, mflg, histlen);
+    if (sp) {
+        hp = enthist(++eventno, sp, 1, mflg, histlen);
+	if (enterhist)
+	    histFileCount++;		/* being loaded from a file */
+	else
+	    histappend(hp);
+    }
     discardExcess(histlen);
 }
 
@@ -1167,7 +1419,7 @@ dohist(Char **vp, struct command *c)
     if (hflg & (HIST_LOAD | HIST_MERGE))
 	loadhist(*vp, (hflg & HIST_MERGE) ? 1 : 0);
     else if (hflg & HIST_SAVE)
-	rechist(*vp, 1);
+	rechist(*vp, 2);		/* now, even with savehist append */
     else {
 	if (*vp)
 	    n = getn(*vp);
@@ -1218,13 +1470,409 @@ dotlock_cleanup(void* lockpath)
 	dot_unlock((char*)lockpath);
 }
 
+/* Is opt one of the words after the number in $savehist? */
+static int
+savehistopt(const Char *opt)
+{
+    struct varent *shist;
+    size_t i;
+
+    if ((shist = adrof(STRsavehist)) == NULL || shist->vec == NULL ||
+	shist->vec[0] == NULL)
+	return 0;
+    for (i = 1; shist->vec[i]; i++)
+	if (eq(shist->vec[i], opt))
+	    return 1;
+    return 0;
+}
+
+/* The name of the history file, as an allocated string. */
+static Char *
+histfilename(void)
+{
+    Char *fname;
+
+    if ((fname = varval(STRhistfile)) == STRNULL)
+	return Strspl(varval(STRhome), &STRtildothist[1]);
+    return Strsave(fname);
+}
+
+/*
+ * The binary history file, written instead of the text one when $savehist
+ * has the word 'binary', can be loaded without running every event through
+ * the lexer.  After a header of HISTBINMAGIC and HISTBINVERSION, each event
+ * is a record of:
+ *	the length of the rest of the record
+ *	Htime and Hnum
+ *	the number of words
+ *	histline, as one more than its length and its text; or 0 if it is
+ *	just the words with spaces between them, or there is none
+ *	each word of Hlex, as its length and its text
+ * The numbers are written 7 bits a byte, lowest first, with the top bit set
+ * in all but the last byte, and the text is multibyte, so the file can be
+ * shared between machines.  A record cut short by a shell dying in the
+ * middle of an append ends the file.
+ */
+#define HISTBINMAGIC	"\0tcshbh"
+#define HISTBINVERSION	1
+#define HISTBINHDR	9
+
+struct histbinmap {
+    char   *map;
+    size_t  size;
+    int     mapped;			/* Whether map came from mmap() */
+};
+
+static void
+histbinput(struct strbuf *buf, unsigned long long val)
+{
+    while (val >= 0x80) {
+	strbuf_append1(buf, (char) ((val & 0x7f) | 0x80));
+	val >>= 7;
+    }
+    strbuf_append1(buf, (char) val);
+}
+
+/* Decode the number at *pp into *val; 0 if it runs past end. */
+static int
+histbinget(const char **pp, const char *end, unsigned long long *val)
+{
+    const char *p;
+    int shift;
+
+    *val = 0;
+    for (p = *pp, shift = 0; p < end && shift < 64; shift += 7) {
+	*val |= (unsigned long long) (*p & 0x7f) << shift;
+	if ((*p++ & 0x80) == 0) {
+	    *pp = p;
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+/* Add str to buf as its length plus plus, and its multibyte text. */
+static void
+histbinstr(struct strbuf *buf, const Char *str, unsigned plus)
+{
+    static struct strbuf mb; /* = strbuf_INIT; */
+    char c[MB_LEN_MAX];
+
+    mb.len = 0;
+    for (; *str; str++)
+	if ((*str & CHAR) < 0x80)	/* The common case, done quickly */
+	    strbuf_append1(&mb, (char) (*str & CHAR));
+	else
+	    strbuf_appendn(&mb, c, one_wctomb(c, *str));
+    histbinput(buf, mb.len + plus);
+    strbuf_appendn(buf, mb.s, mb.len);
+}
+
+/* Return the len bytes of multibyte text at p as a Char string. */
+static Char *
+histbinword(const char *p, size_t len)
+{
+    const char *end = p + len;
+    Char *s, *d;
+
+    d = s = xmalloc((len + 1) * sizeof(*s));
+    while (p < end)
+	if ((unsigned char) *p < 0x80)
+	    *d++ = (unsigned char) *p++;
+	else
+	    p += one_mbtowc(d++, p, end - p);
+    *d = '\0';
+    return s;
+}
+
+/* Is the histline of hp just its words with spaces between them? */
+static int
+histbinplain(const struct Hist *hp)
+{
+    const struct wordent *wp;
+    const Char *l, *w;
+
+    l = hp->histline;
+    for (wp = hp->Hlex.next; wp != &hp->Hlex; wp = wp->next) {
+	if (wp->next == &hp->Hlex && wp->word[0] == '\n' && !wp->word[1])
+	    break;
+	if (wp != hp->Hlex.next && *l++ != ' ')
+	    return 0;
+	for (w = wp->word; *w; )
+	    if (*l++ != *w++)
+		return 0;
+    }
+    return *l == '\0';
+}
+
+static void
+histbinhdr(struct strbuf *buf)
+{
+    strbuf_appendn(buf, HISTBINMAGIC, 8);
+    histbinput(buf, HISTBINVERSION);
+}
+
+/* Add the record of hp to buf. */
+static void
+histbinrec(struct strbuf *buf, struct Hist *hp)
+{
+    static struct strbuf rec; /* = strbuf_INIT; */
+    struct wordent *wp;
+    unsigned long nwords = 0;
+
+    rec.len = 0;
+    histbinput(&rec, (unsigned long long) hp->Htime);
+    histbinput(&rec, (unsigned long long) hp->Hnum);
+    for (wp = hp->Hlex.next; wp != &hp->Hlex; wp = wp->next)
+	nwords++;
+    histbinput(&rec, nwords);
+    if (hp->histline && !histbinplain(hp))
+	histbinstr(&rec, hp->histline, 1);
+    else
+	histbinput(&rec, 0);
+    for (wp = hp->Hlex.next; wp != &hp->Hlex; wp = wp->next)
+	histbinstr(&rec, wp->word, 0);
+    histbinput(buf, rec.len);
+    strbuf_appendn(buf, rec.s, rec.len);
+}
+
+/* Write the last snum events to fd in the binary format, like dophist(). */
+static void
+histbinwrite(int fd, Char *snum)
+{
+    struct strbuf buf = strbuf_INIT;
+    struct Hist *hp;
+    int n;
+
+    cleanup_push(&buf, strbuf_cleanup);
+    histbinhdr(&buf);
+    if (getn(varval(STRhistory)) != 0 && (hp = histTail) != NULL) {
+	if ((unsigned) (n = getn(snum)) < histCount)
+	    for (hp = Histlist.Hnext; --n > 0 && hp->Hnext != NULL;
+		 hp = hp->Hnext)
+		continue;
+	for (; hp != &Histlist; hp = hp->Hprev)
+	    if (hp->Href >= 0)
+		histbinrec(&buf, hp);
+    }
+    (void) xwrite(fd, buf.s, buf.len);
+    cleanup_until(&buf);
+}
+
+static void
+histbinmap_cleanup(void *xmap)
+{
+    struct histbinmap *hm;
+
+    hm = xmap;
+    if (hm->map == NULL)
+	return;
+#ifdef HAVE_MMAP
+    if (hm->mapped)
+	(void) munmap(hm->map, hm->size);
+    else
+#endif /* HAVE_MMAP */
+	xfree(hm->map);
+}
+
+/*
+ * If file is a binary history file, map it and enter its events as
+ * savehist() does the lines of a text one, and return 1; else return 0.
+ */
+static int
+histbinload(const char *file, int mflg)
+{
+    struct histbinmap hm;
+    struct wordent lex, *wp;
+    char hdr[HISTBINHDR];
+    const char *p, *end, *rend;
+    unsigned long long len, t, num, nwords;
+    Char *line;
+    struct stat st;
+    int fd, oenterhist;
+
+    if ((fd = xopen(file, O_RDONLY|O_LARGEFILE)) == -1)
+	return 0;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+	st.st_size < HISTBINHDR || st.st_size > INT_MAX ||
+	xread(fd, hdr, sizeof(hdr)) != sizeof(hdr) ||
+	memcmp(hdr, HISTBINMAGIC, 8) != 0) {
+	xclose(fd);
+	return 0;
+    }
+    if (hdr[8] != HISTBINVERSION) {
+	xclose(fd);
+	return 1;			/* Not one we can read, nor text */
+    }
+    hm.size = st.st_size;
+    hm.map = NULL;
+    hm.mapped = 0;
+#ifdef HAVE_MMAP
+    hm.map = mmap(NULL, hm.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (hm.map == MAP_FAILED)
+	hm.map = NULL;
+    else
+	hm.mapped = 1;
+#endif /* HAVE_MMAP */
+    if (hm.map == NULL) {
+	hm.map = xmalloc(hm.size);
+	if (lseek(fd, 0, L_SET) != 0 ||
+	    xread(fd, hm.map, hm.size) != (ssize_t) hm.size) {
+	    xfree(hm.map);
+	    xclose(fd);
+	    return 1;
+	}
+    }
+    xclose(fd);
+    cleanup_push(&hm, histbinmap_cleanup);
+
+    oenterhist = enterhist;
+    enterhist = 1;			/* For histFileCount in savehist() */
+    lex.word = STRNULL;
+    end = hm.map + hm.size;
+    for (p = hm.map + HISTBINHDR; p < end; p = rend) {
+	if (!histbinget(&p, end, &len) || len > (size_t) (end - p))
+	    break;
+	rend = p + len;
+	if (!histbinget(&p, rend, &t) || !histbinget(&p, rend, &num) ||
+	    !histbinget(&p, rend, &nwords) || !histbinget(&p, rend, &len) ||
+	    len > (size_t) (rend - p) + 1)
+	    break;
+	histvalid = 0;
+	if (len != 0) {
+	    line = histbinword(p, --len);
+	    histline.len = 0;
+	    Strbuf_append(&histline, line);
+	    Strbuf_terminate(&histline);
+	    xfree(line);
+	    histvalid = 1;
+	    p += len;
+	}
+	lex.next = lex.prev = &lex;
+	for (; nwords > 0; nwords--) {
+	    if (!histbinget(&p, rend, &len) || len > (size_t) (rend - p))
+		break;
+	    wp = xmalloc(sizeof(*wp));
+	    wp->word = histbinword(p, len);
+	    wp->prev = lex.prev;
+	    wp->next = &lex;
+	    lex.prev->next = wp;
+	    lex.prev = wp;
+	    p += len;
+	}
+	if (nwords > 0) {
+	    freelex(&lex);
+	    break;
+	}
+	/* Hnum is numbered afresh here, as it is for the text file */
+	if (lex.next != &lex) {
+	    Htime = (time_t) t;
+	    savehist(&lex, mflg);
+	    Htime = 0;			/* In case savehist() did not use it */
+	}
+	freelex(&lex);
+    }
+    histvalid = 0;
+    enterhist = oenterhist;
+    cleanup_until(&hm);
+    return 1;
+}
+
+#ifdef HISTLOCK
+/*
+ * Wait for a lock on the history file open on fd, and return 0; or -1 if
+ * it cannot be locked so, say on a remote file system.  Unlike dot_lock(),
+ * the wait ends as soon as the shell holding the lock is done with it, and
+ * a shell that dies holding it does not leave it behind.  The lock belongs
+ * to the open file, not the process, so the file can still be opened and
+ * closed by name, as loadhist() does, while it is held.
+ */
+static int
+histlock(int fd)
+{
+    int ret;
+# ifdef F_OFD_SETLKW
+    struct flock fl;
+
+    (void) memset(&fl, 0, sizeof(fl));
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;		/* All of it */
+    while ((ret = fcntl(fd, F_OFD_SETLKW, &fl)) == -1 && errno == EINTR)
+	handle_pending_signals();
+# else /* !F_OFD_SETLKW */
+    while ((ret = flock(fd, LOCK_EX)) == -1 && errno == EINTR)
+	handle_pending_signals();
+# endif /* F_OFD_SETLKW */
+    return ret == -1 ? -1 : 0;
+}
+#endif /* HISTLOCK */
+
+/*
+ * With 'savehist append', add each new event to the history file as soon
+ * as it is entered.  A single write with O_APPEND keeps the events of
+ * shells sharing the file from being mixed, and rechist() need not write
+ * the whole file on exit.
+ */
+static void
+histappend(struct Hist *hp)
+{
+    struct strbuf buf = strbuf_INIT;
+    Char *fname;
+    char hdr[HISTBINHDR];
+    struct stat st;
+    int fd, ftmp, oldidfds, binary, empty;
+
+    if (hp == NULL || !savehistopt(STRappend))
+	return;
+    fname = histfilename();
+    cleanup_push(fname, xfree);
+    fd = xopen(short2str(fname), O_RDWR|O_APPEND|O_CREAT|O_LARGEFILE, 0600);
+    cleanup_until(fname);
+    if (fd == -1)
+	return;
+#ifdef HISTLOCK
+    /* Not in the middle of another shell merging it */
+    if (savehistopt(STRlock))
+	(void) histlock(fd);
+#endif /* HISTLOCK */
+    /* Keep to the format the file has, if it is not empty */
+    empty = fstat(fd, &st) == -1 || st.st_size == 0;
+    if (empty)
+	binary = savehistopt(STRbinary);
+    else
+	binary = xread(fd, hdr, sizeof(hdr)) == sizeof(hdr) &&
+	    memcmp(hdr, HISTBINMAGIC, 8) == 0;
+    if (binary) {
+	cleanup_push(&buf, strbuf_cleanup);
+	if (empty)
+	    histbinhdr(&buf);
+	histbinrec(&buf, hp);
+	(void) xwrite(fd, buf.s, buf.len);
+	cleanup_until(&buf);
+	xclose(fd);
+	histFileCount++;
+	return;
+    }
+    flush();
+    oldidfds = didfds;
+    didfds = 0;
+    ftmp = SHOUT;
+    SHOUT = fd;
+    phist(hp, HIST_ONLY | HIST_TIME);
+    flush();
+    SHOUT = ftmp;
+    didfds = oldidfds;
+    xclose(fd);
+    histFileCount++;
+}
+
 /* Save history before exiting the shell. */
 void
 rechist(Char *fname, int ref)
 {
     Char    *snum, *rs;
-    int     fp, ftmp, oldidfds;
-    struct varent *shist;
+    int     fp, ftmp, oldidfds, merge, lock, append, lockfd = -1;
+    unsigned keep = 0;
     char path[MAXPATHLEN];
     struct stat st;
     static Char   *dumphist[] = {STRhistory, STRmhT, 0, 0};
@@ -1239,13 +1887,25 @@ rechist(Char *fname, int ref)
 	((snum = varval(STRhistory)) == STRNULL))
 	snum = STRmaxint;
 
-
-    if (fname == NULL) {
-	if ((fname = varval(STRhistfile)) == STRNULL)
-	    fname = Strspl(varval(STRhome), &STRtildothist[1]);
-	else
-	    fname = Strsave(fname);
+    /*
+     * With 'savehist append' the events are in the file already.  Only
+     * when it has grown to twice the size to be kept, or on 'history -S',
+     * do we compact it, merging first, since other shells have been
+     * adding to it too.
+     */
+    merge = savehistopt(STRmerge);
+    lock = savehistopt(STRlock);
+    append = fname == NULL && savehistopt(STRappend);
+    if (append) {
+	if (snum != STRmaxint)
+	    keep = (unsigned) getn(snum);
+	if (ref < 2 && (snum == STRmaxint || histFileCount <= 2 * keep))
+	    return;
+	merge = 1;
     }
+
+    if (fname == NULL)
+	fname = histfilename();
     else
 	fname = globone(fname, G_ERROR);
     cleanup_push(fname, xfree);
@@ -1273,57 +1933,79 @@ rechist(Char *fname, int ref)
      */
     oldidfds = didfds;
     didfds = 0;
-    if ((shist = adrof(STRsavehist)) != NULL && shist->vec != NULL) {
-	size_t i;
-	int merge = 0, lock = 0;
-
-	for (i = 1; shist->vec[i]; i++) {
-	    if (eq(shist->vec[i], STRmerge))
-		merge++;
-	    if (eq(shist->vec[i], STRlock))
-		lock++;
-	}
-
-	if (merge) {
-	    if (lock) {
+    if (merge) {
+	if (lock) {
+#ifdef HISTLOCK
+	    /* Lock the file itself, and write it in place below */
+	    lockfd = xopen(short2str(fname), O_RDWR|O_CREAT|O_LARGEFILE, 0600);
+	    if (lockfd != -1) {
+		cleanup_push(&lockfd, open_cleanup);
+		if (histlock(lockfd) == -1) {
+		    cleanup_until(&lockfd);
+		    lockfd = -1;
+		}
+	    }
+	    if (lockfd == -1)
+#endif /* HISTLOCK */
+	    {
 #ifndef WINNT_NATIVE
-		char *lockpath = strsave(short2str(fname));
-		cleanup_push(lockpath, xfree);
-		/* Poll in 100 miliseconds interval to obtain the lock. */
-		if ((dot_lock(lockpath, 100) == 0))
-		    cleanup_push(lockpath, dotlock_cleanup);
+	    char *lockpath = strsave(short2str(fname));
+	    cleanup_push(lockpath, xfree);
+	    /* Poll in 100 miliseconds interval to obtain the lock. */
+	    if ((dot_lock(lockpath, 100) == 0))
+		cleanup_push(lockpath, dotlock_cleanup);
 #endif
 	    }
-	    loadhist(fname, 1);
 	}
+	loadhist(fname, 1);
     }
-    rs = randsuf();
-    xsnprintf(path, sizeof(path), "%S.%S", fname, rs);
-    xfree(rs);
-
-    fp = xcreat(path, 0600);
-    if (fp == -1) {
-	didfds = oldidfds;
-	cleanup_until(fname);
-	return;
+    if (lockfd != -1) {
+	/* A new file would not be locked, so replace what is in this one */
+	fp = lockfd;
+	if (lseek(fp, (off_t) 0, L_SET) == -1 ||
+	    ftruncate(fp, (off_t) 0) == -1) {
+	    didfds = oldidfds;
+	    cleanup_until(fname);
+	    return;
+	}
     }
-    /* Try to preserve ownership and permissions of the original history file */
+    else {
+	rs = randsuf();
+	xsnprintf(path, sizeof(path), "%S.%S", fname, rs);
+	xfree(rs);
+
+	fp = xcreat(path, 0600);
+	if (fp == -1) {
+	    didfds = oldidfds;
+	    cleanup_until(fname);
+	    return;
+	}
+	/* Try to preserve ownership and permissions of the original history file */
 #ifndef WINNT_NATIVE
-    if (stat(short2str(fname), &st) != -1) {
-	TCSH_IGNORE(fchown(fp, st.st_uid, st.st_gid));
-	TCSH_IGNORE(fchmod(fp, st.st_mode));
-    }
+	if (stat(short2str(fname), &st) != -1) {
+	    TCSH_IGNORE(fchown(fp, st.st_uid, st.st_gid));
+	    TCSH_IGNORE(fchmod(fp, st.st_mode));
+	}
 #else
-    UNREFERENCED_PARAMETER(st);
+	UNREFERENCED_PARAMETER(st);
 #endif
-    ftmp = SHOUT;
-    SHOUT = fp;
-    dumphist[2] = snum;
-    dohist(dumphist, NULL);
-    xclose(fp);
-    SHOUT = ftmp;
+    }
+    if (savehistopt(STRbinary))
+	histbinwrite(fp, snum);
+    else {
+	ftmp = SHOUT;
+	SHOUT = fp;
+	dumphist[2] = snum;
+	dohist(dumphist, NULL);
+	SHOUT = ftmp;
+    }
     didfds = oldidfds;
-    (void)rename(path, short2str(fname));
+    if (lockfd == -1) {
+	xclose(fp);
+	(void)rename(path, short2str(fname));
+    }
+    if (append)
+	histFileCount = histCount < keep || keep == 0 ? histCount : keep;
     cleanup_until(fname);
 }
 
@@ -1333,6 +2015,10 @@ void
 loadhist(Char *fname, int mflg)
 {
     static Char   *loadhist_cmd[] = {STRsource, NULL, NULL, NULL};
+    Char *f;
+    char *file;
+    int loaded;
+
     loadhist_cmd[1] = mflg ? STRmm : STRmh;
 
     if (fname != NULL)
@@ -1342,7 +2028,17 @@ loadhist(Char *fname, int mflg)
     else
 	loadhist_cmd[2] = STRtildothist;
 
-    dosource(loadhist_cmd, NULL);
+    if (!mflg)
+	histFileCount = 0;
+    /* A binary history file is read directly, a text one with source -h */
+    f = globone(loadhist_cmd[2], G_ERROR);
+    file = strsave(short2str(f));
+    xfree(f);
+    cleanup_push(file, xfree);
+    loaded = histbinload(file, mflg);
+    cleanup_until(file);
+    if (!loaded)
+	dosource(loadhist_cmd, NULL);
 
     /* During history merging (enthist sees mflg set), we disable management of
      * Hnum and Href (because fastMergeErase is true).  So now reset all the
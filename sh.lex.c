@@ -35,8 +35,13 @@
 RCSID("$tcsh$")
 
 #include "ed.h"
+#include "patchlevel.h"
 
 #include <assert.h>
+#include <stdio.h>	/* for rename(2) */
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif /* HAVE_MMAP */
 /* #define DEBUG_INP */
 /* #define DEBUG_SEEK */
 
@@ -56,6 +61,7 @@ static	eChar	 	 getC1		(int);
 static	void	 	 getdol		(void);
 static	void	 	 getexcl	(Char);
 static	struct Hist 	*findev		(Char *, int);
+static	int		 evmatch	(struct Hist *, Char *, int);
 static	void	 	 setexclp	(Char *);
 static	eChar	 	 bgetc		(void);
 static	void		 balloc		(int);
@@ -117,6 +123,12 @@ struct Strbuf labuf; /* = Strbuf_INIT; */
  */
 static int hadhist = 0;
 
+/*
+ * Set when a history substitution used the history list or the :s state,
+ * so that the line cannot be kept by loopsave()
+ */
+static int histref = 0;
+
 /*
  * Avoid alias expansion recursion via \!#
  */
@@ -174,7 +186,7 @@ lex(struct wordent *hp)
     do {
 	struct wordent *new;
 
-	new = xmalloc(sizeof(*new));
+	new = newwordent();
 	new->word = NULL;
 	new->prev = wdp;
 	new->next = hp;
@@ -234,6 +246,40 @@ prlex(struct wordent *sp0)
     }
 }
 
+/*
+ * Every command line makes a word list and drops it again, so freelex()
+ * keeps the nodes for lex() and copylex() instead of giving them back to
+ * the allocator.  A node may still be freed with xfree().
+ */
+#define WDKEEP	1024
+
+static struct wordent *wdkept;	/* Linked through next */
+static int nwdkept;
+
+struct wordent *
+newwordent(void)
+{
+    struct wordent *wdp;
+
+    if ((wdp = wdkept) == NULL)
+	return xmalloc(sizeof(*wdp));
+    wdkept = wdp->next;
+    nwdkept--;
+    return wdp;
+}
+
+void
+freewordent(struct wordent *wdp)
+{
+    if (nwdkept >= WDKEEP) {
+	xfree(wdp);
+	return;
+    }
+    wdp->next = wdkept;
+    wdkept = wdp;
+    nwdkept++;
+}
+
 void
 copylex(struct wordent *hp, struct wordent *fp)
 {
@@ -244,7 +290,7 @@ copylex(struct wordent *hp, struct wordent *fp)
     do {
 	struct wordent *new;
 
-	new = xmalloc(sizeof(*new));
+	new = newwordent();
 	new->word = NULL;
 	new->prev = wdp;
 	new->next = hp;
@@ -273,7 +319,7 @@ freelex(struct wordent *vp)
 	fp = vp->next;
 	vp->next = fp->next;
 	xfree(fp->word);
-	xfree(fp);
+	freewordent(fp);
     }
     vp->prev = vp;
 }
@@ -291,12 +337,12 @@ static Char *
 word(int parsehtime)
 {
     eChar c, c1;
-    struct Strbuf wbuf = Strbuf_INIT;
+    static struct Strbuf wbuf; /* = Strbuf_INIT; kept from word to word */
     Char    hbuf[12];
     int	    h;
     int dolflg;
 
-    cleanup_push(&wbuf, Strbuf_cleanup);
+    wbuf.len = 0;
 loop:
     while ((c = getC(DOALL)) == ' ' || c == '\t')
 	continue;
@@ -420,9 +466,7 @@ loop:
 	c = getC(dolflg);
     }
 ret:
-    cleanup_ignore(&wbuf);
-    cleanup_until(&wbuf);
-    return Strbuf_finish(&wbuf);
+    return Strnsave(wbuf.s, wbuf.len);
 }
 
 static eChar
@@ -698,6 +742,8 @@ getexcl(Char sc)
     if (hp == 0)
 	return;
     hadhist = 1;
+    if (hp != alhistp && hp != &paraml)
+	histref = 1;
     dol = 0;
     if (hp == alhistp)
 	for (ip = hp->next->next; ip != alhistt; ip = ip->next)
@@ -762,6 +808,7 @@ getsub(struct wordent *en)
     eChar   sc;
     int global;
 
+    histref = 1;
     do {
 	exclnxt = 0;
 	global = 0;
@@ -1277,51 +1324,63 @@ gethent(Char sc)
     return (0);
 }
 
-static struct Hist *
-findev(Char *cp, int anyarg)
+/* Does event hp match cp, as findev() looks for it? */
+static int
+evmatch(struct Hist *hp, Char *cp, int anyarg)
 {
-    struct Hist *hp;
-
-    for (hp = Histlist.Hnext; hp; hp = hp->Hnext) {
-	Char   *dp;
-	Char *p, *q;
-	struct wordent *lp = hp->Hlex.next;
-	int     argno = 0;
+    Char   *dp;
+    Char *p, *q;
+    struct wordent *lp = hp->Hlex.next;
+    int     argno = 0;
 
-	/*
-	 * The entries added by alias substitution don't have a newline but do
-	 * have a negative event number. Savehist() trims off these entries,
-	 * but it happens before alias expansion, too early to delete those
-	 * from the previous command.
-	 */
-	if (hp->Hnum < 0)
-	    continue;
-	if (lp->word[0] == '\n')
-	    continue;
-	if (!anyarg) {
+    /*
+     * The entries added by alias substitution don't have a newline but do
+     * have a negative event number. Savehist() trims off these entries,
+     * but it happens before alias expansion, too early to delete those
+     * from the previous command.
+     */
+    if (hp->Hnum < 0)
+	return 0;
+    if (lp->word[0] == '\n')
+	return 0;
+    if (!anyarg) {
+	p = cp;
+	q = lp->word;
+	do
+	    if (!*p)
+		return 1;
+	while (*p++ == *q++);
+	return 0;
+    }
+    do {
+	for (dp = lp->word; *dp; dp++) {
 	    p = cp;
-	    q = lp->word;
+	    q = dp;
 	    do
-		if (!*p)
-		    return (hp);
+		if (!*p) {
+		    quesarg = argno;
+		    return 1;
+		}
 	    while (*p++ == *q++);
-	    continue;
 	}
-	do {
-	    for (dp = lp->word; *dp; dp++) {
-		p = cp;
-		q = dp;
-		do
-		    if (!*p) {
-			quesarg = argno;
-			return (hp);
-		    }
-		while (*p++ == *q++);
-	    }
-	    lp = lp->next;
-	    argno++;
-	} while (lp->word[0] != '\n');
-    }
+	lp = lp->next;
+	argno++;
+    } while (lp->word[0] != '\n');
+    return 0;
+}
+
+static struct Hist *
+findev(Char *cp, int anyarg)
+{
+    struct Hist *hp;
+    int indexed;
+
+    /* Only look at the events with the trigrams of cp, if it has any */
+    indexed = histgramset(cp, 0);
+    for (hp = indexed ? histgramnext(NULL) : Histlist.Hnext; hp;
+	 hp = indexed ? histgramnext(hp) : hp->Hnext)
+	if (evmatch(hp, cp, anyarg))
+	    return (hp);
     seterror(ERR_NOEVENT, short2str(cp));
     return (0);
 }
@@ -1607,6 +1666,100 @@ wide_read(int fildes, Char *buf, size_t nchars, int use_fclens)
     return res != 0 ? res : r;
 }
 
+/*
+ * Decode all of a seekable script of moderate size at once, so that bseek()
+ * and btell() on it need neither read it again nor count characters.  Then
+ * fseekp stays a byte offset and fbuf[0][fseekp - fbobp] is the character
+ * starting there.
+ */
+#define MAPMAX	(4 * 1024 * 1024)
+
+static int
+bmap(off_t x)
+{
+    struct stat st, st0;
+    char *map, *p;
+    size_t size, i;
+    int mapped, len;
+
+    if (fstat(SHIN, &st) == -1 || !S_ISREG(st.st_mode) ||
+	st.st_size <= x || st.st_size - x > MAPMAX)
+	return 0;
+    /*
+     * Commands run from a script that is also their standard input read it
+     * from where our block reads left it; reading it all would leave them
+     * nothing
+     */
+    if (OLDSTD >= 0 && fstat(OLDSTD, &st0) != -1 &&
+	st0.st_dev == st.st_dev && st0.st_ino == st.st_ino)
+	return 0;
+    size = st.st_size - x;
+    map = NULL;
+    mapped = 0;
+#ifdef HAVE_MMAP
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, SHIN, 0);
+    if (map == MAP_FAILED)
+	map = NULL;
+    else if (lseek(SHIN, st.st_size, L_SET) == -1) {
+	(void) munmap(map, st.st_size);
+	return 0;
+    }
+    else
+	mapped = 1;
+#endif /* HAVE_MMAP */
+    if (map == NULL) {
+	map = xmalloc(size);
+	if (xread(SHIN, map, size) != (ssize_t) size) {
+	    xfree(map);
+	    (void) lseek(SHIN, x, L_SET);
+	    return 0;
+	}
+    }
+    p = mapped ? map + x : map;
+    fbuf[0] = xmalloc((size + 1) * sizeof(Char));
+#ifdef WIDE_STRINGS
+    fmlens = xmalloc(size + 1);
+#endif
+    for (i = 0; i < size; i += len) {
+	len = normal_mbtowc(&fbuf[0][i], p + i, size - i);
+	if (len == -1) {
+	    reset_mbtowc();
+	    fbuf[0][i] = (unsigned char) p[i] | INVALID_BYTE;
+	}
+	if (len <= 0)
+	    len = 1;
+#ifdef WIDE_STRINGS
+	fmlens[i] = len;
+#endif
+    }
+#ifdef HAVE_MMAP
+    if (mapped)
+	(void) munmap(map, st.st_size);
+    else
+#endif /* HAVE_MMAP */
+	xfree(map);
+    feobp = x + size;
+    fmapped = 1;
+    return 1;
+}
+
+/*
+ * Past the end of what bmap() decoded the file may have grown; go back
+ * to reading it a block at a time.
+ */
+static void
+bunmap(void)
+{
+    xfree(fbuf[0]);
+    fbuf[0] = xcalloc(BUFSIZE, sizeof(Char));
+#ifdef WIDE_STRINGS
+    xfree(fmlens);
+    fmlens = NULL;
+#endif
+    fmapped = 0;
+    fbobp = feobp = fseekp + 1;	/* To force lseek() */
+}
+
 static eChar
 bgetc(void)
 {
@@ -1615,6 +1768,21 @@ bgetc(void)
     int numleft = 0, roomleft;
 
     if (cantell) {
+	while (fmapped && fseekp >= fbobp && fseekp < feobp) {
+	    ch = fbuf[0][fseekp - fbobp];
+#ifdef WIDE_STRINGS
+	    fseekp += fmlens[fseekp - fbobp];
+#else
+	    fseekp++;
+#endif
+#if defined(WINNT_NATIVE) || defined(__CYGWIN__)
+	    if (ch == '\r')
+		continue;
+#endif /* WINNT_NATIVE || __CYGWIN__ */
+	    return (ch);
+	}
+	if (fmapped)
+	    bunmap();
 	if (fseekp < fbobp || fseekp > feobp) {
 	    fbobp = feobp = fseekp;
 	    (void) lseek(SHIN, fseekp, L_SET);
@@ -1748,7 +1916,7 @@ bseek(struct Ain *l)
 #endif
 	fseekp = l->f_seek;
 #ifdef WIDE_STRINGS
-	if (cantell) {
+	if (cantell && !fmapped) {
 	    if (fseekp >= fbobp && feobp >= fbobp) {
 		size_t i;
 		off_t o;
@@ -1797,7 +1965,7 @@ btell(struct Ain *l)
 	return;
     case TCSH_F_SEEK:
 #ifdef WIDE_STRINGS
-	if (cantell && fseekp >= fbobp && fseekp <= feobp) {
+	if (cantell && !fmapped && fseekp >= fbobp && fseekp <= feobp) {
 	    size_t i;
 
 	    l->f_seek = fbobp;
@@ -1830,6 +1998,611 @@ btoeof(void)
     evalp = NULL;
     wfree();
     bfree();
+    loopfree();
+    srchfree();
+}
+
+/*
+ * The body of a while or foreach loop is read again on every iteration.
+ * Lines coming back to an offset already seen are kept here as the tree
+ * lex(), alias() and syntax() made of them, so that process() only has
+ * to copy it; substitutions are still done when the copy is executed.
+ * Aliases, eval, -c, the terminal, and lines that touched the history
+ * list always take the long way round.
+ */
+#define LOOPHASH	64
+
+struct loopline {
+    struct loopline *l_next;
+    off_t   l_seek;		/* Offset of the start of the line */
+    struct Ain l_end;		/* Where lex() left the input */
+    struct Ain l_loc;		/* lineloc once alias() was done */
+    struct command *l_t;	/* The parse tree, maybe empty */
+    int     l_aliasgen;		/* aliasgen when it was parsed */
+    int     l_state;		/* lexstate() when it was parsed */
+};
+
+static off_t loopseek = -1;	/* Line process() is parsing, or -1 */
+
+/* Is lex() about to read a line of plain file input? */
+static int
+lexinput(void)
+{
+    return aret == TCSH_F_SEEK && !intty && !enterhist && arginp == NULL &&
+	!onelflg && alvec == NULL && alvecp == NULL && evalvec == NULL &&
+	evalp == NULL && peekread == 0 && peekc == 0 && peekd == 0 &&
+	exclp == NULL && lap >= labuf.len;
+}
+
+/* What lex() makes of the same text depends on these */
+static int
+lexstate(void)
+{
+    return ((int) HIST << 1) | (bslash_quote != 0);
+}
+
+static int
+loopinput(void)
+{
+    return whyles != NULL && lexinput();
+}
+
+/*
+ * Called by process() in place of lex(); if the line at the current
+ * offset has been parsed before, skip over it and return its tree.
+ */
+int
+loophit(struct command **tp)
+{
+    struct loopline *lp;
+    struct Ain pos;
+
+    loopseek = -1;
+    if (whyles == NULL) {
+	loopfree();
+	return 0;
+    }
+    if (!loopinput() || adrof(STRverbose))
+	return 0;
+    btell(&pos);
+    lp = floop ? floop[(size_t) pos.f_seek % LOOPHASH] : NULL;
+    for (; lp != NULL; lp = lp->l_next)
+	if (lp->l_seek == pos.f_seek)
+	    break;
+    if (lp == NULL || lp->l_aliasgen != aliasgen ||
+	lp->l_state != lexstate()) {
+	loopseek = pos.f_seek;
+	histref = 0;
+	return 0;
+    }
+    lineloc = lp->l_loc;
+    bseek(&lp->l_end);
+    histvalid = 0;
+    *tp = copysyn(lp->l_t);
+    return 1;
+}
+
+/*
+ * Remember the tree of the line loophit() missed
+ */
+void
+loopsave(struct command *t)
+{
+    struct loopline *lp, **lpp;
+    struct Ain end;
+
+    if (loopseek == -1)
+	return;
+    if (histref || seterr || !loopinput()) {
+	loopseek = -1;
+	return;
+    }
+    btell(&end);
+    if (floop == NULL)
+	floop = xcalloc(LOOPHASH, sizeof(*floop));
+    lpp = &floop[(size_t) loopseek % LOOPHASH];
+    for (lp = *lpp; lp != NULL; lp = lp->l_next)
+	if (lp->l_seek == loopseek)
+	    break;
+    if (lp == NULL) {
+	lp = xmalloc(sizeof(*lp));
+	lp->l_seek = loopseek;
+	lp->l_next = *lpp;
+	*lpp = lp;
+    }
+    else
+	freesyn(lp->l_t);
+    lp->l_end = end;
+    lp->l_loc = lineloc;
+    lp->l_t = copysyn(t);
+    lp->l_aliasgen = aliasgen;
+    lp->l_state = lexstate();
+    loopseek = -1;
+}
+
+void
+loopfree(void)
+{
+    struct loopline *lp;
+    size_t i;
+
+    if (floop == NULL)
+	return;
+    for (i = 0; i < LOOPHASH; i++)
+	while ((lp = floop[i]) != NULL) {
+	    floop[i] = lp->l_next;
+	    freesyn(lp->l_t);
+	    xfree(lp);
+	}
+    xfree(floop);
+    floop = NULL;
+}
+
+/*
+ * Where search() ended up, for each place it started from.  A goto
+ * always starts from the top, so its label is part of the key; so is
+ * the value of a switch, whose case labels must not need substituting.
+ */
+#define SRCHMAX		1024
+
+struct srchline {
+    struct srchline *s_next;
+    off_t   s_seek;		/* Offset search() started from */
+    int     s_type;		/* TC_IF, TC_GOTO, ... */
+    Char   *s_goal;		/* Label or switch value, or NULL */
+    struct Ain s_end;		/* Where it left the input */
+    Char    s_peek;		/* The character it pushed back */
+    int     s_pops;		/* Loops ended by breaksw */
+};
+
+static off_t srchseek = -1;	/* Offset search() is scanning from, or -1 */
+static int nsrch = 0;		/* Entries in fsrch */
+
+static int
+srchinput(void)
+{
+    return aret == TCSH_F_SEEK && !intty && arginp == NULL && !onelflg &&
+	alvec == NULL && alvecp == NULL && evalvec == NULL && evalp == NULL;
+}
+
+static struct srchline **
+srchfind(off_t seek, int type, const Char *goal)
+{
+    struct srchline **spp;
+
+    spp = &fsrch[((size_t) seek + type) % LOOPHASH];
+    for (; *spp != NULL; spp = &(*spp)->s_next)
+	if ((*spp)->s_seek == seek && (*spp)->s_type == type &&
+	    ((*spp)->s_goal == NULL ? goal == NULL :
+	     goal != NULL && Strcmp((*spp)->s_goal, goal) == 0))
+	    break;
+    return spp;
+}
+
+/*
+ * Called by search() before it starts reading; if the same search was
+ * done from here before, go where it went and return the number of
+ * loops it ended.
+ */
+int
+srchhit(int type, const Char *goal, int *pops)
+{
+    struct srchline *sp;
+    struct Ain pos;
+
+    srchseek = -1;
+    if (!srchinput() || peekread != 0)
+	return 0;
+    btell(&pos);
+    if (fsrch == NULL || (sp = *srchfind(pos.f_seek, type, goal)) == NULL) {
+	srchseek = pos.f_seek;
+	return 0;
+    }
+    bseek(&sp->s_end);
+    peekread = sp->s_peek;
+    *pops = sp->s_pops;
+    return 1;
+}
+
+/*
+ * Remember where the search srchhit() missed has ended
+ */
+void
+srchsave(int type, const Char *goal, int pops)
+{
+    struct srchline *sp, **spp;
+
+    if (srchseek == -1)
+	return;
+    if (!srchinput() || nsrch >= SRCHMAX) {
+	srchseek = -1;
+	return;
+    }
+    if (fsrch == NULL)
+	fsrch = xcalloc(LOOPHASH, sizeof(*fsrch));
+    spp = srchfind(srchseek, type, goal);
+    if (*spp == NULL) {
+	sp = xmalloc(sizeof(*sp));
+	sp->s_next = NULL;
+	sp->s_seek = srchseek;
+	sp->s_type = type;
+	sp->s_goal = goal ? Strsave(goal) : NULL;
+	*spp = sp;
+	nsrch++;
+    }
+    else
+	sp = *spp;
+    btell(&sp->s_end);
+    sp->s_peek = peekread;
+    sp->s_pops = pops;
+    srchseek = -1;
+}
+
+void
+srchfree(void)
+{
+    struct srchline *sp;
+    size_t i;
+
+    if (fsrch == NULL)
+	return;
+    for (i = 0; i < LOOPHASH; i++)
+	while ((sp = fsrch[i]) != NULL) {
+	    fsrch[i] = sp->s_next;
+	    xfree(sp->s_goal);
+	    xfree(sp);
+	    nsrch--;
+	}
+    xfree(fsrch);
+    fsrch = NULL;
+}
+
+/*
+ * With sourcecache set to a directory, the words lex() made of each line
+ * of a sourced file are kept there, in a file named after the device and
+ * inode of the source.  The next shell to source it copies those words
+ * instead of lexing the lines again; alias() and syntax() still run on
+ * them, since what they make of the words can differ between shells.
+ */
+#define COMPMAGIC	"\0tcshsc"	/* Followed by COMPVERSION */
+#define COMPVERSION	1
+#define COMPHDR		9
+
+struct compline {
+    struct compline *cl_next;
+    off_t   cl_seek;		/* Offset of the start of the line */
+    off_t   cl_end;		/* Offset lex() stopped at */
+    int     cl_state;		/* compstate() when it was read */
+    Char  **cl_words;		/* The words, ending with "\n" */
+};
+
+struct comp {
+    char   *c_file;		/* Where the compiled form is kept */
+    struct stat c_st;		/* Of the source it was made from */
+    int     c_dirty;		/* Lines were added since it was loaded */
+    struct compline *c_lines[LOOPHASH];
+};
+
+static off_t compseek = -1;	/* Line lex() is reading for compsave() */
+
+/* Offsets count bytes if cantell, else characters */
+static int
+compstate(void)
+{
+    return (lexstate() << 1) | (cantell != 0);
+}
+
+/* Identifies the shell and locale the Chars in the file are good for */
+static const char *
+compident(void)
+{
+    static char ident[128];
+    const char *lc = NULL;
+
+#if defined(NLS) && defined(LC_CTYPE)
+    lc = setlocale(LC_CTYPE, NULL);
+#endif /* NLS && LC_CTYPE */
+    xsnprintf(ident, sizeof(ident), "%d.%02d.%02d %d %s", REV, VERS,
+	      PATCHLEVEL, (int) sizeof(Char), lc ? lc : "");
+    return ident;
+}
+
+static void
+compput(struct strbuf *buf, unsigned long long val)
+{
+    while (val >= 0x80) {
+	strbuf_append1(buf, (char) ((val & 0x7f) | 0x80));
+	val >>= 7;
+    }
+    strbuf_append1(buf, (char) val);
+}
+
+static int
+compget(const char **pp, const char *end, unsigned long long *val)
+{
+    const char *p;
+    int shift;
+
+    *val = 0;
+    for (p = *pp, shift = 0; p < end && shift < 64; shift += 7) {
+	*val |= (unsigned long long) (*p & 0x7f) << shift;
+	if ((*p++ & 0x80) == 0) {
+	    *pp = p;
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+static struct compline **
+compfind(struct comp *cp, off_t seek)
+{
+    struct compline **lpp;
+
+    lpp = &cp->c_lines[(size_t) seek % LOOPHASH];
+    while (*lpp != NULL && (*lpp)->cl_seek != seek)
+	lpp = &(*lpp)->cl_next;
+    return lpp;
+}
+
+static void
+compadd(struct comp *cp, off_t seek, off_t end, int state, Char **words)
+{
+    struct compline *lp, **lpp;
+
+    lpp = compfind(cp, seek);
+    if ((lp = *lpp) == NULL) {
+	lp = xmalloc(sizeof(*lp));
+	lp->cl_next = NULL;
+	lp->cl_seek = seek;
+	*lpp = lp;
+    }
+    else
+	blkfree(lp->cl_words);
+    lp->cl_end = end;
+    lp->cl_state = state;
+    lp->cl_words = words;
+}
+
+static void
+compclear(struct comp *cp)
+{
+    struct compline *lp;
+    size_t i;
+
+    for (i = 0; i < LOOPHASH; i++)
+	while ((lp = cp->c_lines[i]) != NULL) {
+	    cp->c_lines[i] = lp->cl_next;
+	    blkfree(lp->cl_words);
+	    xfree(lp);
+	}
+}
+
+/* Read the lines of a compiled file; 0 if it is not one for this source */
+static int
+compread(struct comp *cp, const char *p, const char *end)
+{
+    unsigned long long seek, span, len, state, nwords, n, c;
+    const char *ident;
+    Char **words;
+    size_t i;
+
+    ident = compident();
+    if (end - p < COMPHDR || memcmp(p, COMPMAGIC, 8) != 0 ||
+	p[8] != COMPVERSION)
+	return 0;
+    p += COMPHDR;
+    if (!compget(&p, end, &len) || len != strlen(ident) ||
+	len > (size_t) (end - p) || memcmp(p, ident, len) != 0)
+	return 0;
+    p += len;
+    if (!compget(&p, end, &n) || n != (unsigned long long) cp->c_st.st_dev ||
+	!compget(&p, end, &n) || n != (unsigned long long) cp->c_st.st_ino ||
+	!compget(&p, end, &n) || n != (unsigned long long) cp->c_st.st_size ||
+	!compget(&p, end, &n) || n != (unsigned long long) cp->c_st.st_mtime)
+	return 0;
+    while (p < end) {
+	if (!compget(&p, end, &seek) || !compget(&p, end, &span) ||
+	    !compget(&p, end, &state) || !compget(&p, end, &nwords) ||
+	    nwords == 0 || nwords > (size_t) (end - p))
+	    return 0;
+	words = xcalloc(nwords + 1, sizeof(*words));
+	for (i = 0; i < nwords; i++) {
+	    if (!compget(&p, end, &len) || len > (size_t) (end - p)) {
+		blkfree(words);
+		return 0;
+	    }
+	    words[i] = xmalloc((len + 1) * sizeof(Char));
+	    for (n = 0; n < len; n++) {
+		if (!compget(&p, end, &c)) {
+		    words[i][n] = 0;
+		    blkfree(words);
+		    return 0;
+		}
+		words[i][n] = (Char) c;
+	    }
+	    words[i][len] = 0;
+	}
+	if (words[nwords - 1][0] != '\n') {
+	    blkfree(words);
+	    return 0;
+	}
+	compadd(cp, (off_t) seek, (off_t) (seek + span), (int) state, words);
+    }
+    return 1;
+}
+
+/*
+ * Called by srcunit() once the new input is set up.  Only a file owned by
+ * us and writable by no one else is trusted, as it is run as it stands.
+ */
+void
+compload(void)
+{
+    struct comp *cp;
+    struct stat st;
+    Char *dir;
+    char *buf;
+    int fd;
+
+    if (enterhist || *(dir = varval(STRsourcecache)) == '\0' ||
+	fstat(SHIN, &st) == -1 || !S_ISREG(st.st_mode))
+	return;
+    cp = xcalloc(1, sizeof(*cp));
+    cp->c_file = xasprintf("%S/%lx.%lx", dir, (unsigned long) st.st_dev,
+			   (unsigned long) st.st_ino);
+    cp->c_st = st;
+    fcomp = cp;
+    if ((fd = xopen(cp->c_file, O_RDONLY|O_LARGEFILE)) == -1)
+	return;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+	st.st_uid != geteuid() || (st.st_mode & (S_IWGRP|S_IWOTH)) != 0 ||
+	st.st_size > INT_MAX) {
+	xclose(fd);
+	return;
+    }
+    buf = xmalloc(st.st_size + 1);
+    if (xread(fd, buf, st.st_size) != (ssize_t) st.st_size ||
+	!compread(cp, buf, buf + st.st_size))
+	compclear(cp);
+    xfree(buf);
+    xclose(fd);
+}
+
+/*
+ * Called by process() in place of lex(); if the line at the current
+ * offset is in the compiled file, put its words in hp and skip over it.
+ */
+int
+comphit(struct wordent *hp)
+{
+    struct compline *lp;
+    struct wordent *wdp;
+    struct Ain pos;
+    Char **v;
+
+    compseek = -1;
+    if (fcomp == NULL || !lexinput())
+	return 0;
+    btell(&pos);
+    if ((lp = *compfind(fcomp, pos.f_seek)) == NULL ||
+	lp->cl_state != compstate()) {
+	compseek = pos.f_seek;
+	histref = 0;
+	return 0;
+    }
+    hp->next = hp->prev = hp;
+    hp->word = STRNULL;
+    for (v = lp->cl_words; *v != NULL; v++) {
+	wdp = newwordent();
+	wdp->word = Strsave(*v);
+	wdp->prev = hp->prev;
+	wdp->next = hp;
+	hp->prev->next = wdp;
+	hp->prev = wdp;
+    }
+    lineloc = pos;
+    pos.f_seek = lp->cl_end;
+    bseek(&pos);
+    hadhist = 0;
+    histvalid = 0;
+    return 1;
+}
+
+/*
+ * Called by process() after lex() read the line comphit() missed
+ */
+void
+compsave(struct wordent *hp)
+{
+    struct wordent *wdp;
+    struct Ain end;
+    Char **words;
+    size_t n;
+
+    if (compseek == -1)
+	return;
+    if (hadhist || histref || seterr || !lexinput()) {
+	compseek = -1;
+	return;
+    }
+    btell(&end);
+    for (n = 0, wdp = hp->next; wdp != hp; wdp = wdp->next)
+	n++;
+    words = xcalloc(n + 1, sizeof(*words));
+    for (n = 0, wdp = hp->next; wdp != hp; wdp = wdp->next)
+	words[n++] = Strsave(wdp->word);
+    compadd(fcomp, compseek, end.f_seek, compstate(), words);
+    fcomp->c_dirty = 1;
+    compseek = -1;
+}
+
+static void
+compwrite(struct comp *cp)
+{
+    static struct strbuf buf; /* = strbuf_INIT; */
+    struct compline *lp;
+    const char *ident;
+    char *tmp;
+    Char **v, *w;
+    size_t i;
+    int fd, ok;
+
+    buf.len = 0;
+    strbuf_appendn(&buf, COMPMAGIC, 8);
+    strbuf_append1(&buf, COMPVERSION);
+    ident = compident();
+    compput(&buf, strlen(ident));
+    strbuf_append(&buf, ident);
+    compput(&buf, (unsigned long long) cp->c_st.st_dev);
+    compput(&buf, (unsigned long long) cp->c_st.st_ino);
+    compput(&buf, (unsigned long long) cp->c_st.st_size);
+    compput(&buf, (unsigned long long) cp->c_st.st_mtime);
+    for (i = 0; i < LOOPHASH; i++)
+	for (lp = cp->c_lines[i]; lp != NULL; lp = lp->cl_next) {
+	    compput(&buf, (unsigned long long) lp->cl_seek);
+	    compput(&buf, (unsigned long long) (lp->cl_end - lp->cl_seek));
+	    compput(&buf, (unsigned long long) lp->cl_state);
+	    compput(&buf, blklen(lp->cl_words));
+	    for (v = lp->cl_words; *v != NULL; v++) {
+		compput(&buf, Strlen(*v));
+		for (w = *v; *w; w++)
+		    compput(&buf, (unsigned long long) *w);
+	    }
+	}
+    /*
+     * The name is easily guessed, so never write through what someone else
+     * left there; give up instead
+     */
+    tmp = xasprintf("%s.%d", cp->c_file, (int) getpid());
+    if ((fd = xopen(tmp, O_WRONLY|O_CREAT|O_EXCL|O_NOFOLLOW|O_LARGEFILE,
+		    0600)) != -1) {
+	ok = xwrite(fd, buf.s, buf.len) == (ssize_t) buf.len;
+	xclose(fd);
+	if (!ok || rename(tmp, cp->c_file) == -1)
+	    (void) unlink(tmp);
+    }
+    xfree(tmp);
+}
+
+/*
+ * Called when the sourced file is done with; writes out the lines that
+ * were not in the compiled file yet.
+ */
+void
+compfree(void)
+{
+    struct comp *cp;
+
+    if ((cp = fcomp) == NULL)
+	return;
+    fcomp = NULL;
+    /* A file changed within this second could change again unnoticed */
+    if (cp->c_dirty && cp->c_st.st_mtime < time(NULL))
+	compwrite(cp);
+    compclear(cp);
+    xfree(cp->c_file);
+    xfree(cp);
 }
 
 void
@@ -1843,7 +2616,8 @@ settell(void)
 	return;
     fbuf = xcalloc(2, sizeof(Char **));
     fblocks = 1;
-    fbuf[0] = xcalloc(BUFSIZE, sizeof(Char));
     fseekp = fbobp = feobp = x;
+    if (!bmap(x))
+	fbuf[0] = xcalloc(BUFSIZE, sizeof(Char));
     cantell = 1;
 }
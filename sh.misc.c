@@ -270,7 +270,7 @@ closem(void)
     num_files = NOFILE;
     for (f = 0; f < num_files; f++)
 	if (f != SHIN && f != SHOUT && f != SHDIAG && f != OLDSTD &&
-	    f != FSHTTY 
+	    f != FSHTTY && (f != FSHWATCH || !havwatch)
 #ifdef MALLOC_TRACE
 	    && f != 25
 #endif /* MALLOC_TRACE */
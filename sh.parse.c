@@ -41,6 +41,7 @@ static	int		 asyntax (struct wordent *, struct wordent *);
 static	int		 asyn0 	 (struct wordent *, struct wordent *);
 static	int		 asyn3	 (struct wordent *, struct wordent *);
 static	struct wordent	*freenod (struct wordent *, struct wordent *);
+static	struct command	*newsyn	 (void);
 static	struct command	*syn0	 (const struct wordent *, const struct wordent *, int);
 static	struct command	*syn1	 (const struct wordent *, const struct wordent *, int);
 static	struct command	*syn1a	 (const struct wordent *, const struct wordent *, int);
@@ -175,7 +176,7 @@ asyn3(struct wordent *p1, struct wordent *p2)
 	alout.next->prev = p1;
 	p1->next = alout.next;
 	xfree(alout.prev->word);
-	xfree(alout.prev);
+	freewordent(alout.prev);
     }
     return 1;
 }
@@ -188,7 +189,7 @@ freenod(struct wordent *p1, struct wordent *p2)
     while (p1 != p2) {
 	xfree(p1->word);
 	p1 = p1->next;
-	xfree(p1->prev);
+	freewordent(p1->prev);
     }
     retp->next = p2;
     p2->prev = retp;
@@ -262,7 +263,7 @@ syn0(const struct wordent *p1, const struct wordent *p2, int flags)
 	    if (t1->t_dtyp == NODE_LIST ||
 		t1->t_dtyp == NODE_AND ||
 		t1->t_dtyp == NODE_OR) {
-		t = xcalloc(1, sizeof(*t));
+		t = newsyn();
 		t->t_dtyp = NODE_PAREN;
 		t->t_dflg = F_AMPERSAND | F_NOINTERRUPT;
 		t->t_dspr = t1;
@@ -270,7 +271,7 @@ syn0(const struct wordent *p1, const struct wordent *p2, int flags)
 	    }
 	    else
 		t1->t_dflg |= F_AMPERSAND | F_NOINTERRUPT;
-	    t = xcalloc(1, sizeof(*t));
+	    t = newsyn();
 	    t->t_dtyp = NODE_LIST;
 	    t->t_dflg = 0;
 	    t->t_dcar = t1;
@@ -313,7 +314,7 @@ syn1(const struct wordent *p1, const struct wordent *p2, int flags)
 	case '\n':
 	    if (l != 0)
 		break;
-	    t = xcalloc(1, sizeof(*t));
+	    t = newsyn();
 	    t->t_dtyp = NODE_LIST;
 	    t->t_dcar = syn1a(p1, p, flags);
 	    t->t_dcdr = syntax(p->next, p2, flags);
@@ -354,7 +355,7 @@ syn1a(const struct wordent *p1, const struct wordent *p2, int flags)
 	    if (p->word[1] != '|')
 		continue;
 	    if (l == 0) {
-		t = xcalloc(1, sizeof(*t));
+		t = newsyn();
 		t->t_dtyp = NODE_OR;
 		t->t_dcar = syn1b(p1, p, flags);
 		t->t_dcdr = syn1a(p->next, p2, flags);
@@ -394,7 +395,7 @@ syn1b(const struct wordent *p1, const struct wordent *p2, int flags)
 
 	case '&':
 	    if (p->word[1] == '&' && l == 0) {
-		t = xcalloc(1, sizeof(*t));
+		t = newsyn();
 		t->t_dtyp = NODE_AND;
 		t->t_dcar = syn2(p1, p, flags);
 		t->t_dcdr = syn1b(p->next, p2, flags);
@@ -437,7 +438,7 @@ syn2(const struct wordent *p1, const struct wordent *p2, int flags)
 	case '|':
 	    if (l != 0)
 		continue;
-	    t = xcalloc(1, sizeof(*t));
+	    t = newsyn();
 	    f = flags | P_OUT;
 	    pn = p->next;
 	    if (pn != p2 && pn->word[0] == '&') {
@@ -541,7 +542,7 @@ again:
 	}
     if (n < 0)
 	n = 0;
-    t = xcalloc(1, sizeof(*t));
+    t = newsyn();
     av = xcalloc(n + 1, sizeof(Char **));
     t->t_dcom = av;
     n = 0;
@@ -646,6 +647,28 @@ again:
     return (t);
 }
 
+/*
+ * Like the nodes of word lists, those of the parse tree of each command
+ * line are kept by freesyn() for the next one.
+ */
+#define SYNKEEP	256
+
+static struct command *synkept;	/* Linked through t_dcar */
+static int nsynkept;
+
+static struct command *
+newsyn(void)
+{
+    struct command *t;
+
+    if ((t = synkept) == NULL)
+	return xcalloc(1, sizeof(*t));
+    synkept = t->t_dcar;
+    nsynkept--;
+    memset(t, 0, sizeof(*t));
+    return t;
+}
+
 void
 freesyn(struct command *t)
 {
@@ -680,7 +703,49 @@ freesyn(struct command *t)
 #ifdef DEBUG
     memset(t, 0, sizeof(*t));
 #endif
-    xfree(t);
+    if (nsynkept >= SYNKEEP) {
+	xfree(t);
+	return;
+    }
+    t->t_dcar = synkept;
+    synkept = t;
+    nsynkept++;
+}
+
+/*
+ * Make a copy of a parse tree that execute() can scribble on
+ */
+struct command *
+copysyn(const struct command *t)
+{
+    struct command *nt;
+
+    if (t == 0)
+	return (0);
+    nt = newsyn();
+    *nt = *t;
+    switch (t->t_dtyp) {
+
+    case NODE_COMMAND:
+	nt->t_dcom = saveblk(t->t_dcom);
+	/*FALLTHROUGH*/
+    case NODE_PAREN:
+	nt->t_dspr = copysyn(t->t_dspr);
+	nt->t_dlef = t->t_dlef ? Strsave(t->t_dlef) : NULL;
+	nt->t_drit = t->t_drit ? Strsave(t->t_drit) : NULL;
+	break;
+
+    case NODE_AND:
+    case NODE_OR:
+    case NODE_PIPE:
+    case NODE_LIST:
+	nt->t_dcar = copysyn(t->t_dcar);
+	nt->t_dcdr = copysyn(t->t_dcdr);
+	break;
+    default:
+	break;
+    }
+    return (nt);
 }
 
 void
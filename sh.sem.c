@@ -55,9 +55,18 @@ RCSID("$tcsh$")
 # endif /* !MACH && SYSVREL == 0 && !Lynx && !BSD4_4 && !glibc */
 #endif /* __sparc__ || sparc */
 
+#if defined(HAVE_POSIX_SPAWN) && defined(CLOSE_ON_EXEC) && !defined(WINNT_NATIVE)
+# define SPAWN		/* posix_spawn() simple external commands */
+# include <spawn.h>
+#endif /* HAVE_POSIX_SPAWN && CLOSE_ON_EXEC && !WINNT_NATIVE */
+
 #ifdef VFORK
 static	void		vffree		(int);
 #endif 
+#ifdef SPAWN
+static	int		 plainredir	(Char *);
+static	pid_t		 pspawn		(struct command *, int, int);
+#endif /* SPAWN */
 static	Char		*splicepipe	(struct command *, Char *);
 static	void		 doio		(struct command *, int *, int *);
 static	void		 chkclob	(const char *);
@@ -200,6 +209,8 @@ execute(struct command *t, volatile int wanttty, int *pipein, int *pipeout,
 	/*FALLTHROUGH*/
 
     case NODE_PAREN:
+	if (t->t_drit)
+	    ftflush();		/* What file tests saw may change */
 #ifdef BACKPIPE
 	if (t->t_dflg & F_PIPEIN)
 	    mypipe(pipein);
@@ -388,6 +399,11 @@ execute(struct command *t, volatile int wanttty, int *pipein, int *pipeout,
 	 */
 	    (bifunc && (t->t_dflg & F_PIPEIN) != 0 &&
 	     bifunc->bfunct == (bfunc_t)doeval)) {
+#ifdef SPAWN
+	    if (!bifunc && (pid = pspawn(t, wanttty, do_glob)) != 0)
+		forked++;
+	    else
+#endif /* SPAWN */
 #ifdef VFORK
 	    if (t->t_dtyp == NODE_PAREN ||
 		t->t_dflg & (F_REPEAT | F_AMPERSAND) || bifunc)
@@ -960,6 +976,136 @@ doio(struct command *t, int *pipein, int *pipeout)
     didfds = 1;
 }
 
+#ifdef SPAWN
+/*
+ * Is the redirection word one that doio() would use as it is?
+ */
+static int
+plainredir(Char *cp)
+{
+    Char *blk[2];
+    Char *p;
+
+    if (cp == NULL)
+	return 1;
+    for (p = cp; *p; p++)
+	if ((*p & QUOTE) || any("$`'\"\\", *p))
+	    return 0;
+    blk[0] = cp;
+    blk[1] = NULL;
+    return tglob(blk) == 0;
+}
+
+/*
+ * Start a simple external command with posix_spawn(), doing with file
+ * actions what doio() and doexec() do in a forked child.  Anything that
+ * needs the child to think for itself, such as job control, globbing,
+ * or expanded redirections, returns 0 and takes the usual fork path.
+ * So does a failed spawn, so that the forked child reports the error.
+ */
+static pid_t
+pspawn(struct command *t, int wanttty, int do_glob)
+{
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    sigset_t set, mask;
+    unsigned long flags = t->t_dflg;
+    Char **av;
+    char **argv, *path, *lef, *rit;
+    pid_t pid;
+    int err;
+
+    if (t->t_dtyp != NODE_COMMAND || wanttty >= 0 || didfds ||
+	(flags & (F_READ | F_PIPEIN | F_PIPEOUT | F_AMPERSAND | F_NICE |
+		  F_NOHUP | F_HUP | F_TIME | F_REPEAT)) != 0)
+	return 0;
+#ifdef F_VER
+    if (flags & F_VER)
+	return 0;
+#endif /* F_VER */
+    if (OLDSTD < 0 || SHOUT < 0 || SHDIAG < 0 || adrof(STRecho))
+	return 0;
+
+    /*
+     * The child can only reset signals to their defaults; see pfork().
+     */
+    sigemptyset(&set);
+    if (tpgrp == -1 && (flags & F_NOINTERRUPT))
+	return 0;
+    if (setintr) {
+	if ((gointr && eq(gointr, STRminus)) ||
+	    parterm.sa_handler == SIG_IGN)
+	    return 0;
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGQUIT);
+	sigaddset(&set, SIGTERM);
+    }
+
+    if ((do_glob && tglob(t->t_dcom)) ||
+	!plainredir(t->t_dlef) || !plainredir(t->t_drit))
+	return 0;
+    if (t->t_drit && !(flags & F_OVERWRITE) && no_clobber)
+	return 0;
+
+    av = saveblk(t->t_dcom);
+    cleanup_push(av, blk_cleanup);
+    trim(av);
+    if (*av == NULL || **av == '\0' || (path = hashpath(*av)) == NULL) {
+	cleanup_until(av);
+	return 0;
+    }
+    cleanup_push(path, xfree);
+    argv = short2blk(av);
+    cleanup_push(argv, blk_cleanup);
+    lef = t->t_dlef ? strsave(short2str(t->t_dlef)) : NULL;
+    cleanup_push(lef, xfree);
+    rit = t->t_drit ? strsave(short2str(t->t_drit)) : NULL;
+    cleanup_push(rit, xfree);
+
+    /*
+     * The same order as doio(), so that < /dev/std{in,out,err} work
+     */
+    posix_spawn_file_actions_init(&fa);
+    if (lef != NULL && SHIN >= 0)
+	posix_spawn_file_actions_adddup2(&fa, SHIN, 0);
+    else if (lef == NULL)
+	posix_spawn_file_actions_adddup2(&fa, OLDSTD, 0);
+    posix_spawn_file_actions_adddup2(&fa, SHOUT, 1);
+    posix_spawn_file_actions_adddup2(&fa, SHDIAG, 2);
+    if (lef != NULL)
+	posix_spawn_file_actions_addopen(&fa, 0, lef, O_RDONLY|O_LARGEFILE, 0);
+    if (rit != NULL)
+	posix_spawn_file_actions_addopen(&fa, 1, rit, (flags & F_APPEND) ?
+	    O_WRONLY|O_APPEND|O_CREAT|O_LARGEFILE :
+	    O_WRONLY|O_CREAT|O_TRUNC|O_LARGEFILE, 0666);
+    if (flags & F_STDERR)
+	posix_spawn_file_actions_adddup2(&fa, 1, 2);
+
+    /* What doexec() unblocks */
+    sigprocmask(SIG_BLOCK, NULL, &mask);
+    sigdelset(&mask, SIGINT);
+    sigdelset(&mask, SIGCHLD);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setsigdefault(&attr, &set);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK |
+	POSIX_SPAWN_SETSIGDEF);
+
+    /*
+     * Hold pchild() until we have the process installed in our table.
+     */
+    pchild_disabled++;
+    cleanup_push(&pchild_disabled, disabled_cleanup);
+    err = posix_spawn(&pid, path, &fa, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+    if (err == 0)
+	palloc(pid, t);
+    cleanup_until(av);
+    return err == 0 ? pid : 0;
+}
+#endif /* SPAWN */
+
 void
 mypipe(int *pv)
 {
@@ -48,23 +48,125 @@ static	void		 update_vars	(Char *);
 static	Char		*getinx		(Char *, int *);
 static	void		 asx		(Char *, int, Char *);
 static	struct varent 	*getvx		(Char *, int);
-static	Char		*xset		(Char *, Char ***);
-static	Char		*operate	(int, Char *, Char *);
+static	tcsh_number_t	 xset		(Char *, Char ***);
+static	tcsh_number_t	 operate	(int, Char *, Char *);
+static	void		 letnum		(Char *, tcsh_number_t);
+static	Char		**setglob	(Char **, int);
+static	void		 setappend	(const Char *, Char **, int);
+static	void		 vecfree	(struct varent *);
 static	void	 	 putn1		(tcsh_number_t);
 static	struct varent	*madrof		(Char *, struct varent *);
 static	void		 unsetv1	(struct varent *);
 static	void		 exportpath	(Char **);
 static	void		 balance	(struct varent *, int, int);
+static	unsigned int	 varhval	(const Char *);
+static	struct varhash	*varhashof	(const struct varent *);
+static	void		 varhadd	(struct varhash *, struct varent *);
+static	void		 varhdel	(struct varhash *, struct varent *);
 static	int		 set_noclobber  (Char **);
 
 /*
  * C Shell
  */
 
+/*
+ * Variables whose setting has side effects.  update_vars() finds the name
+ * through a small hash table built on first use, so that an ordinary
+ * variable costs one hash instead of a comparison with each of these.
+ */
+enum uvar {
+    UV_NONE, UV_PATH, UV_NOCLOBBER, UV_HISTCHARS, UV_PROMPTCHARS, UV_HISTLIT,
+    UV_USER, UV_GROUP, UV_WORDCHARS, UV_LOGINSH, UV_ANYERROR, UV_SYMLINKS,
+    UV_TERM, UV_HOME, UV_EDIT, UV_VIMODE, UV_SHLVL, UV_IGNOREEOF,
+    UV_BACKSLASH_QUOTE, UV_COMPAT_EXPR, UV_DIRSTACK,
+    UV_RECOGNIZE_ONLY_EXECUTABLES, UV_PATHWATCH, UV_KILLRING, UV_HISTORY,
+    UV_WATCH, UV_IMPLICITCD, UV_CDTOHOME, UV_COLOR, UV_DSPMBYTE, UV_CATALOG,
+    UV_FILEC
+};
+
+static const struct uvname {
+    const Char *name;
+    enum uvar code;
+} uvnames[] = {
+    { STRpath,		UV_PATH },
+    { STRnoclobber,	UV_NOCLOBBER },
+    { STRhistchars,	UV_HISTCHARS },
+    { STRpromptchars,	UV_PROMPTCHARS },
+    { STRhistlit,	UV_HISTLIT },
+    { STRuser,		UV_USER },
+    { STRgroup,		UV_GROUP },
+    { STRwordchars,	UV_WORDCHARS },
+    { STRloginsh,	UV_LOGINSH },
+    { STRanyerror,	UV_ANYERROR },
+    { STRsymlinks,	UV_SYMLINKS },
+    { STRterm,		UV_TERM },
+    { STRhome,		UV_HOME },
+    { STRedit,		UV_EDIT },
+    { STRvimode,	UV_VIMODE },
+    { STRshlvl,		UV_SHLVL },
+    { STRignoreeof,	UV_IGNOREEOF },
+    { STRbackslash_quote, UV_BACKSLASH_QUOTE },
+    { STRcompat_expr,	UV_COMPAT_EXPR },
+    { STRdirstack,	UV_DIRSTACK },
+    { STRrecognize_only_executables, UV_RECOGNIZE_ONLY_EXECUTABLES },
+    { STRpathwatch,	UV_PATHWATCH },
+    { STRkillring,	UV_KILLRING },
+    { STRhistory,	UV_HISTORY },
+#ifndef HAVENOUTMP
+    { STRwatch,		UV_WATCH },
+#endif /* HAVENOUTMP */
+    { STRimplicitcd,	UV_IMPLICITCD },
+    { STRcdtohome,	UV_CDTOHOME },
+#ifdef COLOR_LS_F
+    { STRcolor,		UV_COLOR },
+#endif /* COLOR_LS_F */
+#if defined(KANJI) && defined(SHORT_STRINGS) && defined(DSPMBYTE)
+    { CHECK_MBYTEVAR,	UV_DSPMBYTE },
+    { STRnokanji,	UV_DSPMBYTE },
+#endif
+#ifdef NLS_CATALOGS
+    { STRcatalog,	UV_CATALOG },
+#if defined(FILEC) && defined(TIOCSTI)
+    { STRfilec,		UV_FILEC },
+#endif
+#endif /* NLS_CATALOGS */
+};
+
+#define UVHASHSIZE	128	/* A power of 2, over twice the names */
+
+static unsigned char uvhash[UVHASHSIZE];	/* Index in uvnames + 1 */
+static unsigned int uvhval[sizeof(uvnames) / sizeof(*uvnames)];
+static int uvinit;
+
+static enum uvar
+uvcode(const Char *vp)
+{
+    unsigned int h;
+    size_t i, n;
+
+    if (!uvinit) {
+	uvinit = 1;
+	for (n = 0; n < sizeof(uvnames) / sizeof(*uvnames); n++) {
+	    uvhval[n] = varhval(uvnames[n].name);
+	    for (i = uvhval[n] & (UVHASHSIZE - 1); uvhash[i] != 0;
+		 i = (i + 1) & (UVHASHSIZE - 1))
+		continue;
+	    uvhash[i] = n + 1;
+	}
+    }
+    h = varhval(vp);
+    for (i = h & (UVHASHSIZE - 1); (n = uvhash[i]) != 0;
+	 i = (i + 1) & (UVHASHSIZE - 1))
+	if (uvhval[n - 1] == h && eq(vp, uvnames[n - 1].name))
+	    return uvnames[n - 1].code;
+    return UV_NONE;
+}
+
 static void
 update_vars(Char *vp)
 {
-    if (eq(vp, STRpath)) {
+    switch (uvcode(vp)) {
+    case UV_PATH: {
 	struct varent *p = adrof(STRpath); 
 	if (p == NULL)
 	    stderror(ERR_NAME | ERR_UNDVAR);
@@ -72,15 +174,17 @@ update_vars(Char *vp)
 	    exportpath(p->vec);
 	    dohash(NULL, NULL);
 	}
+	break;
     }
-    else if (eq(vp, STRnoclobber)) {
+    case UV_NOCLOBBER: {
 	struct varent *p = adrof(STRnoclobber);
 	if (p == NULL)
 	    stderror(ERR_NAME | ERR_UNDVAR);
 	else
 	    no_clobber = set_noclobber(p->vec);
+	break;
     }
-    else if (eq(vp, STRhistchars)) {
+    case UV_HISTCHARS: {
 	Char *pn = varval(vp);
 
 	HIST = *pn++;
@@ -88,8 +192,9 @@ update_vars(Char *vp)
 	    HISTSUB = *pn;
 	else
 	    HISTSUB = HIST;
+	break;
     }
-    else if (eq(vp, STRpromptchars)) {
+    case UV_PROMPTCHARS: {
 	Char *pn = varval(vp);
 
 	PRCH = *pn++;
@@ -97,27 +202,28 @@ update_vars(Char *vp)
 	    PRCHROOT = *pn;
 	else
 	    PRCHROOT = PRCH;
+	break;
     }
-    else if (eq(vp, STRhistlit)) {
+    case UV_HISTLIT:
 	HistLit = 1;
-    }
-    else if (eq(vp, STRuser)) {
+	break;
+    case UV_USER:
 	tsetenv(STRKUSER, varval(vp));
 	tsetenv(STRLOGNAME, varval(vp));
-    }
-    else if (eq(vp, STRgroup)) {
+	break;
+    case UV_GROUP:
 	tsetenv(STRKGROUP, varval(vp));
-    }
-    else if (eq(vp, STRwordchars)) {
+	break;
+    case UV_WORDCHARS:
 	word_chars = varval(vp);
-    }
-    else if (eq(vp, STRloginsh)) {
+	break;
+    case UV_LOGINSH:
 	loginsh = 1;
-    }
-    else if (eq(vp, STRanyerror)) {
+	break;
+    case UV_ANYERROR:
 	anyerror = 1;
-    }
-    else if (eq(vp, STRsymlinks)) {
+	break;
+    case UV_SYMLINKS: {
 	Char *pn = varval(vp);
 
 	if (eq(pn, STRignore))
@@ -128,8 +234,9 @@ update_vars(Char *vp)
 	    symlinks = SYM_CHASE;
 	else
 	    symlinks = 0;
+	break;
     }
-    else if (eq(vp, STRterm)) {
+    case UV_TERM: {
 	Char *cp = varval(vp);
 	tsetenv(STRKTERM, cp);
 #ifdef DOESNT_WORK_RIGHT
@@ -145,8 +252,9 @@ update_vars(Char *vp)
 	    setNS(STRedit);
 	}
 	ed_Init();		/* reset the editor */
+	break;
     }
-    else if (eq(vp, STRhome)) {
+    case UV_HOME: {
 	Char *cp, *canon;
 
 	cp = Strsave(varval(vp));	/* get the old value back */
@@ -167,20 +275,21 @@ update_vars(Char *vp)
 	/* fix directory stack for new tilde home */
 	dtilde();
 	cleanup_until(canon);
+	break;
     }
-    else if (eq(vp, STRedit)) {
+    case UV_EDIT:
 	editing = 1;
 	noediting = 0;
 	/* PWP: add more stuff in here later */
-    }
-    else if (eq(vp, STRvimode)) {
+	break;
+    case UV_VIMODE:
 	VImode = 1;
 	update_wordchars();
-    }
-    else if (eq(vp, STRshlvl)) {
+	break;
+    case UV_SHLVL:
 	tsetenv(STRKSHLVL, varval(vp));
-    }
-    else if (eq(vp, STRignoreeof)) {
+	break;
+    case UV_IGNOREEOF: {
 	Char *cp;
 	numeof = 0;
     	for ((cp = varval(STRignoreeof)); cp && *cp; cp++) {
@@ -191,56 +300,65 @@ update_vars(Char *vp)
 	    numeof = numeof * 10 + *cp - '0';
 	}
 	if (numeof <= 0) numeof = 26;	/* Sanity check */
-    } 
-    else if (eq(vp, STRbackslash_quote)) {
-	bslash_quote = 1;
+	break;
     }
-    else if (eq(vp, STRcompat_expr)) {
+    case UV_BACKSLASH_QUOTE:
+	bslash_quote = 1;
+	break;
+    case UV_COMPAT_EXPR:
 	compat_expr = 1;
-    }
-    else if (eq(vp, STRdirstack)) {
+	break;
+    case UV_DIRSTACK:
 	dsetstack();
-    }
-    else if (eq(vp, STRrecognize_only_executables)) {
+	break;
+    case UV_RECOGNIZE_ONLY_EXECUTABLES:
 	tw_cmd_free();
-    }
-    else if (eq(vp, STRkillring)) {
+	break;
+    case UV_PATHWATCH:
+	if (havhash)
+	    dohash(NULL, NULL);
+	break;
+    case UV_KILLRING:
 	SetKillRing((int)getn(varval(vp)));
-    }
-    else if (eq(vp, STRhistory)) {
+	break;
+    case UV_HISTORY:
 	sethistory((int)getn(varval(vp)));
-    }
+	break;
 #ifndef HAVENOUTMP
-    else if (eq(vp, STRwatch)) {
+    case UV_WATCH:
 	resetwatch();
-    }
+	break;
 #endif /* HAVENOUTMP */
-    else if (eq(vp, STRimplicitcd)) {
+    case UV_IMPLICITCD:
 	implicit_cd = ((eq(varval(vp), STRverbose)) ? 2 : 1);
-    }
-    else if (eq(vp, STRcdtohome)) {
+	break;
+    case UV_CDTOHOME:
 	cdtohome = 1;
-    }
+	break;
 #ifdef COLOR_LS_F
-    else if (eq(vp, STRcolor)) {
+    case UV_COLOR:
 	set_color_context();
-    }
+	break;
 #endif /* COLOR_LS_F */
 #if defined(KANJI) && defined(SHORT_STRINGS) && defined(DSPMBYTE)
-    else if(eq(vp, CHECK_MBYTEVAR) || eq(vp, STRnokanji)) {
+    case UV_DSPMBYTE:
 	update_dspmbyte_vars();
-    }
+	break;
 #endif
 #ifdef NLS_CATALOGS
-    else if (eq(vp, STRcatalog)) {
+    case UV_CATALOG:
 	nlsclose();
 	nlsinit();
-    }
+	break;
 #if defined(FILEC) && defined(TIOCSTI)
-    else if (eq(vp, STRfilec))
+    case UV_FILEC:
 	filec = 1;
+	break;
 #endif
 #endif /* NLS_CATALOGS */
+    default:
+	break;
+    }
 }
 
 
@@ -257,6 +375,7 @@ doset(Char **v, struct command *c)
     int    first_match = 0;
     int    last_match = 0;
     int    changed = 0;
+    int    append;
 
     USE(c);
     v++;
@@ -288,6 +407,7 @@ doset(Char **v, struct command *c)
     }
     do {
 	hadsub = 0;
+	append = 0;
 	vp = p;
 	if (!letter(*p))
 	    stderror(ERR_NAME | ERR_VARBEGIN);
@@ -298,6 +418,10 @@ doset(Char **v, struct command *c)
 	    hadsub++;
 	    p = getinx(p, &subscr);
 	}
+	else if (*p == '+' && p[1] == '=') {
+	    *p++ = '\0';
+	    append = 1;
+	}
 	if (*p != '\0' && *p != '=')
 	    stderror(ERR_NAME | ERR_VARALNUM);
 	if (*p == '=') {
@@ -309,6 +433,11 @@ doset(Char **v, struct command *c)
 	    if (*++v != NULL)
 		p = *v++;
 	}
+	else if (*v && eq(*v, STRplusequal) && !hadsub) {
+	    append = 1;
+	    if (*++v != NULL)
+		p = *v++;
+	}
 	if (eq(p, STRLparen)) {
 	    Char **e = v;
 
@@ -329,7 +458,10 @@ doset(Char **v, struct command *c)
 	    else if (last_match)
 	       flags |= VAR_LAST;
 
-	    set1(vp, vecp, &shvhed, flags);
+	    if (append)
+		setappend(vp, vecp, flags);
+	    else
+		set1(vp, vecp, &shvhed, flags);
 	    *e = p;
 	    v = e + 1;
 	}
@@ -342,6 +474,12 @@ doset(Char **v, struct command *c)
 	    cleanup_ignore(copy);
 	    cleanup_until(copy);
 	}
+	else if (append) {
+	    vecp = xmalloc(2 * sizeof(Char **));
+	    vecp[0] = Strsave(p);
+	    vecp[1] = NULL;
+	    setappend(vp, vecp, flags);
+	}
 	else
 	    setv(vp, Strsave(p), flags);
 	update_vars(vp);
@@ -371,6 +509,7 @@ asx(Char *vp, int subscr, Char *p)
     prev = v->vec[subscr - 1];
     cleanup_push(prev, xfree);
     v->vec[subscr - 1] = globone(p, G_APPEND);
+    v->v_flags &= ~VAR_NUMBER;
     cleanup_until(prev);
 }
 
@@ -394,6 +533,7 @@ dolet(Char **v, struct command *dummy)
     Char   *vp, c, op;
     int    hadsub;
     int     subscr;
+    tcsh_number_t n;
 
     USE(dummy);
     v++;
@@ -432,14 +572,14 @@ dolet(Char **v, struct command *dummy)
 	cleanup_push(vp, xfree);
 	if (op == '=') {
 	    c = '=';
-	    p = xset(p, &v);
+	    n = xset(p, &v);
 	}
 	else {
 	    c = *p++;
 	    if (any("+-", c)) {
 		if (c != op || *p)
 		    stderror(ERR_NAME | ERR_UNKNOWNOP);
-		p = Strsave(STR1);
+		n = 1;
 	    }
 	    else {
 		if (any("<>", op)) {
@@ -449,42 +589,48 @@ dolet(Char **v, struct command *dummy)
 		}
 		if (c != '=')
 		    stderror(ERR_NAME | ERR_UNKNOWNOP);
-		p = xset(p, &v);
+		n = xset(p, &v);
 	    }
 	}
-	cleanup_push(p, xfree);
 	if (op == '=') {
-	    if (hadsub)
+	    if (hadsub) {
+		p = putn(n);
+		cleanup_push(p, xfree);
 		asx(vp, subscr, p);
+		cleanup_until(p);
+	    }
 	    else
-		setv(vp, p, VAR_READWRITE);
-	    cleanup_ignore(p);
+		letnum(vp, n);
 	}
 	else if (hadsub) {
 	    struct varent *gv = getvx(vp, subscr);
-	    Char *val;
 
-	    val = operate(op, gv->vec[subscr - 1], p);
-	    cleanup_push(val, xfree);
-	    asx(vp, subscr, val);
-	    cleanup_ignore(val);
-	    cleanup_until(val);
+	    p = putn(n);
+	    cleanup_push(p, xfree);
+	    p = putn(operate(op, gv->vec[subscr - 1], p));
+	    cleanup_push(p, xfree);
+	    asx(vp, subscr, p);
+	    cleanup_until(p);
 	}
 	else {
-	    Char *val;
+	    struct varent *gv = adrof(vp);
 
-	    val = operate(op, varval(vp), p);
-	    cleanup_push(val, xfree);
-	    setv(vp, val, VAR_READWRITE);
-	    cleanup_ignore(val);
-	    cleanup_until(val);
+	    /* A number @ stored needs no parsing for ++, --, += or -= */
+	    if (gv != NULL && (gv->v_flags & VAR_NUMBER) && any("+-", op))
+		n = op == '+' ? gv->v_num + n : gv->v_num - n;
+	    else {
+		p = putn(n);
+		cleanup_push(p, xfree);
+		n = operate(op, varval(vp), p);
+	    }
+	    letnum(vp, n);
 	}
 	update_vars(vp);
 	cleanup_until(vp);
     } while ((p = *v++) != NULL);
 }
 
-static Char *
+static tcsh_number_t
 xset(Char *cp, Char ***vp)
 {
     Char *dp;
@@ -495,10 +641,10 @@ xset(Char *cp, Char ***vp)
 	xfree(** vp);
 	**vp = dp;
     }
-    return (putn(expr(vp)));
+    return (expr(vp));
 }
 
-static Char *
+static tcsh_number_t
 operate(int op, Char *vp, Char *p)
 {
     Char    opr[2];
@@ -521,7 +667,35 @@ operate(int op, Char *vp, Char *p)
     i = expr(&vecp);
     if (*vecp)
 	stderror(ERR_NAME | ERR_EXPRESSION);
-    return (putn(i));
+    return (i);
+}
+
+/*
+ * Give a whole variable the result of @, keeping the number with it; a
+ * number kept from before is replaced in place.
+ */
+static void
+letnum(Char *vp, tcsh_number_t n)
+{
+    struct varent *v;
+    Char *p;
+
+    p = putn(n);
+    if ((v = adrof(vp)) != NULL && (v->v_flags & VAR_NUMBER) &&
+	!(v->v_flags & VAR_READONLY)) {
+	xfree(v->vec[0]);
+	v->vec[0] = p;
+	v->v_num = n;
+	return;
+    }
+    cleanup_push(p, xfree);
+    setv(vp, p, VAR_READWRITE);
+    cleanup_ignore(p);
+    cleanup_until(p);
+    if ((v = adrof(vp)) != NULL) {
+	v->v_num = n;
+	v->v_flags |= VAR_NUMBER;
+    }
 }
 
 static Char *putp;
@@ -613,11 +787,107 @@ madrof(Char *pat, struct varent *vp)
     return vp;
 }
 
+/*
+ * Besides the tree, which keeps them sorted for set and completion, the
+ * entries of each list are hashed by name, so that looking one up does not
+ * walk down the tree comparing names.  setq() is the only way into a tree.
+ */
+struct varhash {
+    const struct varent *vh_head;
+    struct varent **vh_tab;
+    size_t  vh_size;		/* A power of 2 */
+    size_t  vh_count;
+};
+
+#define VARHASHES	4		/* shvhed, aliases, completions */
+#define VARHASHSIZE	64
+
+static struct varhash varhash[VARHASHES];
+
+static unsigned int
+varhval(const Char *name)
+{
+    unsigned int h = 2166136261U;
+
+    while (*name) {
+	h ^= (unsigned int) *name++;
+	h *= 16777619U;
+    }
+    return h;
+}
+
+/* NULL if there are more lists than slots; then only the tree is used */
+static struct varhash *
+varhashof(const struct varent *head)
+{
+    size_t i;
+
+    for (i = 0; i < VARHASHES; i++) {
+	if (varhash[i].vh_head == head)
+	    return &varhash[i];
+	if (varhash[i].vh_head == NULL && head->v_left == NULL) {
+	    varhash[i].vh_head = head;
+	    varhash[i].vh_size = VARHASHSIZE;
+	    varhash[i].vh_tab = xcalloc(VARHASHSIZE, sizeof(struct varent *));
+	    return &varhash[i];
+	}
+    }
+    return NULL;
+}
+
+static void
+varhadd(struct varhash *vh, struct varent *c)
+{
+    struct varent **tab, *n;
+    size_t i, size;
+
+    if (vh->vh_count >= vh->vh_size) {
+	size = vh->vh_size * 2;
+	tab = xcalloc(size, sizeof(*tab));
+	for (i = 0; i < vh->vh_size; i++)
+	    while ((n = vh->vh_tab[i]) != NULL) {
+		vh->vh_tab[i] = n->v_hnext;
+		n->v_hnext = tab[n->v_hval & (size - 1)];
+		tab[n->v_hval & (size - 1)] = n;
+	    }
+	xfree(vh->vh_tab);
+	vh->vh_tab = tab;
+	vh->vh_size = size;
+    }
+    i = c->v_hval & (vh->vh_size - 1);
+    c->v_hnext = vh->vh_tab[i];
+    vh->vh_tab[i] = c;
+    vh->vh_count++;
+}
+
+static void
+varhdel(struct varhash *vh, struct varent *c)
+{
+    struct varent **np;
+
+    for (np = &vh->vh_tab[c->v_hval & (vh->vh_size - 1)]; *np != NULL;
+	 np = &(*np)->v_hnext)
+	if (*np == c) {
+	    *np = c->v_hnext;
+	    vh->vh_count--;
+	    return;
+	}
+}
+
 struct varent *
 adrof1(const Char *name, struct varent *v)
 {
+    struct varhash *vh;
+    unsigned int h;
     int cmp;
 
+    if ((vh = varhashof(v)) != NULL) {
+	h = varhval(name);
+	for (v = vh->vh_tab[h & (vh->vh_size - 1)]; v; v = v->v_hnext)
+	    if (v->v_hval == h && Strcmp(name, v->v_name) == 0)
+		break;
+	return v;
+    }
     v = v->v_left;
     while (v && ((cmp = *name - *v->v_name) != 0 || 
 		 (cmp = Strcmp(name, v->v_name)) != 0))
@@ -656,21 +926,7 @@ setv(const Char *var, Char *val, int flags)
 void
 set1(const Char *var, Char **vec, struct varent *head, int flags)
 {
-    Char **oldv = vec;
-
-    if ((flags & VAR_NOGLOB) == 0) {
-	int gflag;
-
-	gflag = tglob(oldv);
-	if (gflag) {
-	    vec = globall(oldv, gflag);
-	    if (vec == 0) {
-		blkfree(oldv);
-		stderror(ERR_NAME | ERR_NOMATCH);
-	    }
-	    blkfree(oldv);
-	}
-    }
+    vec = setglob(vec, flags);
     /*
      * Uniqueness addition from: Michael Veksler <mveksler@vnet.ibm.com>
      */
@@ -724,19 +980,120 @@ set1(const Char *var, Char **vec, struct varent *head, int flags)
 }
 
 
+static Char **
+setglob(Char **vec, int flags)
+{
+    Char **oldv = vec;
+
+    if ((flags & VAR_NOGLOB) == 0) {
+	int gflag;
+
+	gflag = tglob(oldv);
+	if (gflag) {
+	    vec = globall(oldv, gflag);
+	    if (vec == 0) {
+		blkfree(oldv);
+		stderror(ERR_NAME | ERR_NOMATCH);
+	    }
+	    blkfree(oldv);
+	}
+    }
+    return vec;
+}
+
+/*
+ * set name += words: the words go on the end of the value in place while
+ * it has room, and the room doubles when it has not, so that a list built
+ * an item at a time stays linear.  The -r, -f and -l forms and a variable
+ * that is not set yet go the long way through set1().
+ */
+static void
+setappend(const Char *var, Char **vec, int flags)
+{
+    struct varent *v;
+    Char **base;
+    size_t n;
+
+    vec = setglob(vec, flags);
+    if ((v = adrof(var)) == NULL || flags != VAR_READWRITE) {
+	if (v != NULL && v->vec != NULL) {
+	    Char **ovec = vec;
+
+	    cleanup_push(ovec, blk_cleanup);
+	    base = saveblk(v->vec);
+	    vec = blkspl(base, ovec);
+	    xfree(base);
+	    cleanup_ignore(ovec);
+	    cleanup_until(ovec);
+	    xfree(ovec);
+	}
+	set1(var, vec, &shvhed, flags | VAR_NOGLOB);
+	return;
+    }
+    if (v->v_flags & VAR_READONLY) {
+	blkfree(vec);
+	stderror(ERR_READONLY|ERR_NAME, v->v_name);
+    }
+    if (v->v_room == 0)
+	v->v_room = v->v_len = blklen(v->vec);
+    n = blklen(vec);
+    if (v->v_len + n > v->v_room) {
+	if ((base = v->v_base) != NULL) {
+	    (void) memmove(base, v->vec, (v->v_len + 1) * sizeof(*base));
+	    v->v_base = NULL;
+	}
+	else
+	    base = v->vec;
+	v->v_room = (v->v_len + n) * 2;
+	v->vec = xrealloc(base, (v->v_room + 1) * sizeof(*base));
+    }
+    (void) memcpy(v->vec + v->v_len, vec, (n + 1) * sizeof(*vec));
+    trim(v->vec + v->v_len);
+    v->v_len += n;
+    v->v_flags &= ~VAR_NUMBER;
+    xfree(vec);
+}
+
+static void
+vecfree(struct varent *c)
+{
+    Char **v;
+
+    if (c->v_base == NULL) {
+	blkfree(c->vec);
+	return;
+    }
+    for (v = c->vec; *v; v++)
+	xfree(*v);
+    xfree(c->v_base);
+}
+
 void
 setq(const Char *name, Char **vec, struct varent *p, int flags)
 {
+    struct varhash *vh;
     struct varent *c;
     int f;
 
+    if ((vh = varhashof(p)) != NULL && (c = adrof1(name, p)) != NULL) {
+	if (c->v_flags & VAR_READONLY)
+	    stderror(ERR_READONLY|ERR_NAME, c->v_name);
+	vecfree(c);
+	c->v_base = NULL;
+	c->v_room = 0;
+	c->v_flags = flags;
+	trim(c->vec = vec);
+	return;
+    }
     f = 0;			/* tree hangs off the header's left link */
     while ((c = p->v_link[f]) != 0) {
 	if ((f = *name - *c->v_name) == 0 &&
 	    (f = Strcmp(name, c->v_name)) == 0) {
 	    if (c->v_flags & VAR_READONLY)
 		stderror(ERR_READONLY|ERR_NAME, c->v_name);
-	    blkfree(c->vec);
+	    vecfree(c);
+	    c->v_base = NULL;
+	    c->v_room = 0;
 	    c->v_flags = flags;
 	    trim(c->vec = vec);
 	    return;
@@ -750,6 +1107,11 @@ setq(const Char *name, Char **vec, struct varent *p, int flags)
     c->v_bal = 0;
     c->v_left = c->v_right = 0;
     c->v_parent = p;
+    c->v_base = NULL;
+    c->v_room = 0;
+    c->v_hval = varhval(name);
+    if (vh != NULL)
+	varhadd(vh, c);
     balance(p, f, 0);
     trim(c->vec = vec);
 }
@@ -810,6 +1172,8 @@ unset(Char **v, struct command *c)
 	VImode = 0;
     if (did_roe && adrof(STRrecognize_only_executables) == 0)
 	tw_cmd_free();
+    if (havwatch && adrof(STRpathwatch) == 0)
+	hashunwatch();
     if (adrof(STRhistory) == 0)
 	sethistory(0);
 #ifdef COLOR_LS_F
@@ -857,13 +1221,18 @@ unsetv(Char *var)
 static void
 unsetv1(struct varent *p)
 {
+    struct varhash *vh;
     struct varent *c, *pp;
     int f;
 
+    for (c = p; c->v_parent != NULL; c = c->v_parent)
+	continue;
+    if ((vh = varhashof(c)) != NULL)
+	varhdel(vh, p);
     /*
      * Free associated memory first to avoid complications.
      */
-    blkfree(p->vec);
+    vecfree(p);
     xfree(p->v_name);
     /*
      * If p is missing one child, then we can move the other into where p is.
@@ -879,7 +1248,16 @@ unsetv1(struct varent *p)
 	    continue;
 	p->v_name = c->v_name;
 	p->v_flags = c->v_flags;
+	p->v_num = c->v_num;
 	p->vec = c->vec;
+	p->v_base = c->v_base;
+	p->v_room = c->v_room;
+	p->v_len = c->v_len;
+	if (vh != NULL) {
+	    varhdel(vh, c);
+	    p->v_hval = c->v_hval;
+	    varhadd(vh, p);
+	}
 	p = c;
 	c = p->v_left;
     }
@@ -924,7 +1302,15 @@ shift(Char **v, struct command *c)
 	udvar(name);
     if (argv->vec[0] == 0)
 	stderror(ERR_NAME | ERR_NOMORE);
-    lshift(argv->vec, 1);
+    xfree(argv->vec[0]);
+    if (argv->v_base == NULL)
+	argv->v_base = argv->vec;
+    argv->vec++;
+    if (argv->v_room != 0) {
+	argv->v_room--;
+	argv->v_len--;
+    }
+    argv->v_flags &= ~VAR_NUMBER;
     update_vars(name);
 }
 
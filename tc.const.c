@@ -97,6 +97,10 @@ Char STRtmpsh[]		= { '/', 't', 'm', 'p', '/', 's', 'h', '\0' };
 Char STRverbose[]	= { 'v', 'e', 'r', 'b', 'o', 's', 'e', '\0' };
 Char STRecho[]		= { 'e', 'c', 'h', 'o', '\0' };
 Char STRpath[]		= { 'p', 'a', 't', 'h', '\0' };
+Char STRhashfile[]	= { 'h', 'a', 's', 'h', 'f', 'i', 'l', 'e', '\0' };
+Char STRhashthreads[]	= { 'h', 'a', 's', 'h', 't', 'h', 'r', 'e', 'a', 'd', 's',
+			    '\0' };
+Char STRpathwatch[]	= { 'p', 'a', 't', 'h', 'w', 'a', 't', 'c', 'h', '\0' };
 Char STRprompt[]	= { 'p', 'r', 'o', 'm', 'p', 't', '\0' };
 Char STRprompt2[]	= { 'p', 'r', 'o', 'm', 'p', 't', '2', '\0' };
 Char STRprompt3[]	= { 'p', 'r', 'o', 'm', 'p', 't', '3', '\0' };
@@ -110,12 +114,16 @@ Char STRhistory[]	= { 'h', 'i', 's', 't', 'o', 'r', 'y', '\0' };
 Char STRhistdup[]	= { 'h', 'i', 's', 't', 'd', 'u', 'p', '\0' };
 Char STRhistfile[]	= { 'h', 'i', 's', 't', 'f', 'i', 'l', 'e', '\0' };
 Char STRsource[]	= { 's', 'o', 'u', 'r', 'c', 'e', '\0' };
+Char STRsourcecache[]	= { 's', 'o', 'u', 'r', 'c', 'e', 'c', 'a', 'c', 'h', 'e',
+			    '\0' };
 Char STRmh[]		= { '-', 'h', '\0' };
 Char STRmhT[]		= { '-', 'h', 'T', '\0' };
 Char STRmm[]		= { '-', 'm', '\0' };
 Char STRmr[]		= { '-', 'r', '\0' };
 Char STRmerge[]		= { 'm', 'e', 'r', 'g', 'e', '\0' };
 Char STRlock[]		= { 'l', 'o', 'c', 'k', '\0' };
+Char STRappend[]	= { 'a', 'p', 'p', 'e', 'n', 'd', '\0' };
+Char STRbinary[]	= { 'b', 'i', 'n', 'a', 'r', 'y', '\0' };
 Char STRtildothist[]	= { '~', '/', '.', 'h', 'i', 's', 't', 'o', 'r', 
 			    'y', '\0' };
 
@@ -298,6 +306,7 @@ Char STRor[]		= { '|', '\0' };
 Char STRcaret[]		= { '^', '\0' };
 Char STRand[]		= { '&', '\0' };
 Char STRequal[]		= { '=', '\0' };
+Char STRplusequal[]	= { '+', '=', '\0' };
 Char STRbang[]		= { '!', '\0' };
 Char STRtilde[]		= { '~', '\0' };
 Char STRLparen[]	= { '(', '\0' };
@@ -311,6 +320,8 @@ Char STRminus[]		= { '-', '\0' };
 Char STRnoglob[]	= { 'n', 'o', 'g', 'l', 'o', 'b', '\0' };
 Char STRnonomatch[]	= { 'n', 'o', 'n', 'o', 'm', 'a', 't', 'c', 'h', '\0' };
 Char STRglobstar[]	= { 'g', 'l', 'o', 'b', 's', 't', 'a', 'r', '\0' };
+Char STRglobthreads[]	= { 'g', 'l', 'o', 'b', 't', 'h', 'r', 'e', 'a', 'd', 's',
+			    '\0' };
 Char STRglobdot[]	= { 'g', 'l', 'o', 'b', 'd', 'o', 't', '\0' };
 Char STRfakecom1[]	= { '`', ' ', '.', '.', '.', ' ', '`', '\0' };
 Char STRampm[]		= { 'a', 'm', 'p', 'm', '\0' };
@@ -347,6 +358,8 @@ Char STRbackqpwd[]	= { '`', 'p', 'w', 'd', '`', '\0' };
 #if defined(FILEC) && defined(TIOCSTI)
 Char STRfilec[]		= { 'f', 'i', 'l', 'e', 'c', '\0' };
 #endif /* FILEC && TIOCSTI */
+Char STRfiletestcache[]	= { 'f', 'i', 'l', 'e', 't', 'e', 's', 't', 'c', 'a',
+			    'c', 'h', 'e', '\0' };
 Char STRhistchars[]	= { 'h', 'i', 's', 't', 'c', 'h', 'a', 'r', 's', '\0' };
 Char STRpromptchars[]	= { 'p', 'r', 'o', 'm', 'p', 't', 'c', 'h', 'a', 'r',
 			    's', '\0' };
@@ -367,6 +367,9 @@ struct ucred {
 #ifndef O_EXCL
 # define O_EXCL		0
 #endif /* O_EXCL */
+#ifndef O_NOFOLLOW
+# define O_NOFOLLOW	0
+#endif /* O_NOFOLLOW */
 #ifndef O_LARGEFILE
 # define O_LARGEFILE	0
 #endif /* O_LARGEFILE */
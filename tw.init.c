@@ -197,6 +197,53 @@ tw_cmd_free(void)
     tw_cmd_got = 0;
 } /* end tw_cmd_free */
 
+/* tw_cmd_change():
+ *	Add or remove the system command name found in directory dir,
+ *	if the command list has been built
+ */
+void
+tw_cmd_change(const Char *dir, const Char *name, int add)
+{
+    const struct biltins *bptr;
+    Char *path;
+    size_t i, len;
+    int ok;
+
+    if ((tw_cmd_got & TW_FL_CMD) == 0)
+	return;
+    len = Strlen(name);
+    if (len == 0 || name[0] == '#' || name[0] == '.' ||
+	name[len - 1] == '~' || name[len - 1] == '%')
+	return;			/* Ignored by tw_cmd_cmd() too */
+
+    if (add) {
+	if (adrof(STRrecognize_only_executables)) {
+	    path = Strspl(dir, STRslash);
+	    ok = executable(path, name, 0);
+	    xfree(path);
+	    if (!ok)
+		return;
+	}
+	tw_cmd_add(name);
+	tw_cmd_got &= ~TW_FL_SORT;
+	return;
+    }
+
+    /* Aliases and builtins stay even when the command goes */
+    if (adrof1(name, &aliases))
+	return;
+    for (bptr = bfunc; bptr < &bfunc[nbfunc]; bptr++)
+	if (eq(name, str2short(bptr->bname)))
+	    return;
+    for (i = 0; i < tw_cmd.nlist; i++)
+	if (Strcmp(tw_cmd.list[i], name) == 0) {
+	    (void) memmove(&tw_cmd.list[i], &tw_cmd.list[i + 1],
+			   (tw_cmd.nlist - i - 1) * sizeof(Char *));
+	    tw_cmd.nlist--;
+	    return;
+	}
+} /* end tw_cmd_change */
+
 /* tw_cmd_cmd():
  *	Add system commands to the command list
  */
@@ -2310,24 +2310,10 @@ Char *
 tgetenv(Char *str)
 {
     Char  **var;
-    size_t  len;
-    int     res;
-
-    len = Strlen(str);
-    /* Search the STR_environ for the entry matching str. */
-    for (var = STR_environ; var != NULL && *var != NULL; var++)
-	if (Strlen(*var) >= len && (*var)[len] == '=') {
-	  /* Temporarily terminate the string so we can copy the variable
-	     name. */
-	    (*var)[len] = '\0';
-	    res = StrQcmp(*var, str);
-	    /* Restore the '=' and return a pointer to the value of the
-	       environment variable. */
-	    (*var)[len] = '=';
-	    if (res == 0)
-		return (&((*var)[len + 1]));
-	}
-    return (NULL);
+
+    if ((var = envfind(str)) == NULL)
+	return (NULL);
+    return (&((*var)[Strlen(str) + 1]));
 } /* end tgetenv */
 
 
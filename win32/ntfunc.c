@@ -50,8 +50,8 @@ extern DWORD gdwPlatform;
 
 extern	 int StrQcmp(Char *, Char *);
 extern int hashval_extern(Char*);
-extern int bit_extern(int,int);
-extern void bis_extern(int,int);
+extern int bit_extern(Char*,int,int);
+extern void bis_extern(Char*,int);
 extern int hashname(Char*);
 
 extern void NT_ClearScreen_WholeBuffer(void);
@@ -852,7 +852,7 @@ int nt_try_fast_exec(struct command *t) {
 #pragma warning(disable:4310)
 		if (!slash && ABSOLUTEP(pv[0]) && havhash) {
 #pragma warning(default:4310)
-			if (!bit_extern(hashval,i)){
+			if (!bit_extern(*av,hashval,i)){
 				pv++;i++;
 				continue;
 			}
@@ -1186,7 +1186,7 @@ nt_check_name_and_hash(int is_windir, char *file, int i)
 	char name_only[MAX_PATH];
 	char *tmp = (char *)strrchr(file, '.');
 	char uptmp[5], *nameptr, *np2;
-	int icount, hashval;
+	int icount;
 
 	if(!tmp || tmp[4]) 
 		goto nodot;
@@ -1205,9 +1205,7 @@ nt_check_name_and_hash(int is_windir, char *file, int i)
 		*np2++= (char)tolower(*nameptr);
 		nameptr++;
 	}
-	hashval = hashname(str2short(name_only));
-	bis_extern(hashval, i);
+	bis_extern(str2short(name_only), i);
 nodot:
-	hashval = hashname(str2short(file));
-	bis_extern(hashval, i);
+	bis_extern(str2short(file), i);
 }